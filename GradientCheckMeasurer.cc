@@ -76,6 +76,11 @@ void GradientCheckMeasurer::measureExample()
   file->flush();
 }
 
+bool GradientCheckMeasurer::NeedsDerivatives()
+{
+  return true;
+}
+
 GradientCheckMeasurer::~GradientCheckMeasurer()
 {
 }
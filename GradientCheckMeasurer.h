@@ -4,10 +4,11 @@
 #include "Measurer.h"
 #include "GradientMachine.h"
 #include "Criterion.h"
+#include "derivatives_reader.h"
 
 namespace Torch {
 
-class GradientCheckMeasurer : public Measurer
+class GradientCheckMeasurer : public Measurer, public DerivativesReader
 {
   public:
     real *save_params;
@@ -24,6 +25,8 @@ class GradientCheckMeasurer : public Measurer
     //-----
 
     virtual void measureExample();
+    // Compares the der_params with finite differences.
+    virtual bool NeedsDerivatives();
     virtual ~GradientCheckMeasurer();
 };
 
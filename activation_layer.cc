@@ -0,0 +1,42 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "activation_layer.h"
+#include "activations.h"
+
+namespace Torch {
+
+ActivationLayer::ActivationLayer(int n_units, int activation_) : GradientMachine(n_units, n_units)
+{
+  activation = activation_;
+}
+
+void ActivationLayer::frameForward(int t, real *f_inputs, real *f_outputs)
+{
+  ActivateArray(activation, f_inputs, f_outputs, n_inputs);
+}
+
+void ActivationLayer::frameBackward(int t, real *f_inputs, real *beta_, real *f_outputs, real *alpha_)
+{
+  if(partial_backprop)
+    return;
+
+  ActivationBackwardArray(activation, f_outputs, alpha_, beta_, n_outputs);
+}
+
+ActivationLayer::~ActivationLayer()
+{
+}
+
+}
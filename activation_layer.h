@@ -0,0 +1,46 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_ACTIVATION_LAYER_H_
+#define TORCH_ACTIVATION_LAYER_H_
+
+#include "GradientMachine.h"
+
+namespace Torch {
+
+// Applies one of the activations of activations.h to each unit, with the
+// vectorized kernels. Used by Coder as the nonlinear layer of the approximate
+// nonlinearities ("sigmoid_fast", "tanh_table", ...), which have no Torch
+// machine.
+class ActivationLayer : public GradientMachine
+{
+  public:
+
+    int activation;
+
+    /// Create a layer with #n_units# units.
+    ActivationLayer(int n_units, int activation_);
+
+    //-----
+
+    virtual void frameForward(int t, real *f_inputs, real *f_outputs);
+    virtual void frameBackward(int t, real *f_inputs, real *beta_, real *f_outputs, real *alpha_);
+
+    virtual ~ActivationLayer();
+};
+
+}
+
+
+#endif  // TORCH_ACTIVATION_LAYER_H_
@@ -0,0 +1,101 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "activations.h"
+
+namespace Torch {
+
+real sigmoid_table[kSigmoidTableSize+1];
+
+static void InitSigmoidTable()
+{
+  static bool initialized = false;
+  if(initialized)
+    return;
+
+  for(int i=0; i<=kSigmoidTableSize; i++)    {
+    real x = -kSigmoidTableRange + (2.*kSigmoidTableRange*i)/kSigmoidTableSize;
+    sigmoid_table[i] = 1./(1.+exp(-x));
+  }
+  initialized = true;
+}
+
+ActivationType ActivationFromNonlinearity(std::string nonlinearity)
+{
+  if(nonlinearity=="sigmoid")
+    return kActivationSigmoid;
+  else if(nonlinearity=="tanh")
+    return kActivationTanh;
+  else if(nonlinearity=="nonlinear")
+    return kActivationSoftsign;
+  else if(nonlinearity=="sigmoid_fast")
+    return kActivationSigmoidFast;
+  else if(nonlinearity=="tanh_fast")
+    return kActivationTanhFast;
+  else if(nonlinearity=="sigmoid_table")        {
+    InitSigmoidTable();
+    return kActivationSigmoidTable;
+  }     else if(nonlinearity=="tanh_table")     {
+    InitSigmoidTable();
+    return kActivationTanhTable;
+  }     else
+    return kActivationNone;
+}
+
+std::string BaseNonlinearity(std::string nonlinearity)
+{
+  size_t pos = nonlinearity.rfind('_');
+  if(pos == std::string::npos)
+    return nonlinearity;
+
+  std::string suffix = nonlinearity.substr(pos);
+  if(suffix=="_fast" || suffix=="_table")
+    return nonlinearity.substr(0, pos);
+  else
+    return nonlinearity;
+}
+
+template <int activation>
+static void ActivateArrayT(real *inputs, real *outputs, int n)
+{
+  int n_simd = SimdFloor(n);
+  int i=0;
+  for(; i<n_simd; i+=kSimdWidth)
+    SimdStore(outputs+i, ActivateSimd(activation, SimdLoad(inputs+i)));
+  for(; i<n; i++)
+    outputs[i] = Activate(activation, inputs[i]);
+}
+
+void ActivateArray(int activation, real *inputs, real *outputs, int n)
+{
+  TORCH_SWITCH_ACTIVATION(activation, ActivateArrayT, (inputs, outputs, n))
+}
+
+template <int activation>
+static void ActivationBackwardArrayT(real *outputs, real *alpha, real *beta, int n)
+{
+  int n_simd = SimdFloor(n);
+  int i=0;
+  for(; i<n_simd; i+=kSimdWidth)
+    SimdStore(beta+i, SimdLoad(alpha+i) * ActivationDerivativeSimd(activation, SimdLoad(outputs+i)));
+  for(; i<n; i++)
+    beta[i] = alpha[i] * ActivationDerivative(activation, outputs[i]);
+}
+
+void ActivationBackwardArray(int activation, real *outputs, real *alpha, real *beta, int n)
+{
+  TORCH_SWITCH_ACTIVATION(activation, ActivationBackwardArrayT, (outputs, alpha, beta, n))
+}
+
+}
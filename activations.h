@@ -0,0 +1,231 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_ACTIVATIONS_H_
+#define TORCH_ACTIVATIONS_H_
+
+#include "general.h"
+#include "simd.h"
+#include <string>
+
+namespace Torch {
+
+// The activations that the linear kernels can apply to their outputs, so that
+// a Coder does not need a separate pass for its nonlinear layer. The exact ones
+// compute the same thing as the Sigmoid, Tanh and Nonlinear machines.
+//
+// Sigmoid and tanh also come in cheaper versions, selected by a suffix of the
+// Coder nonlinearity string:
+//   - "_fast": a rational approximation of tanh (relative error around 1e-6),
+//     which only needs arithmetic and vectorizes fully;
+//   - "_table": linear interpolation in a table of the sigmoid.
+// The softsign "nonlinear" unit is already rational and has no variants.
+//
+// The derivatives are expressed in terms of the output y of the activation,
+// which is what the backward has at hand. The approximate versions use the
+// derivative of the function they approximate.
+enum ActivationType {
+  kActivationNone = 0,
+  kActivationSigmoid,
+  kActivationTanh,
+  kActivationSoftsign,     // the "nonlinear" unit, see nonlinear.h
+  kActivationSigmoidFast,
+  kActivationTanhFast,
+  kActivationSigmoidTable,
+  kActivationTanhTable
+};
+
+// The activation for a Coder nonlinearity string, or kActivationNone if it
+// can't be fused (none, logsoftmax).
+ActivationType ActivationFromNonlinearity(std::string nonlinearity);
+
+// The nonlinearity without its accuracy suffix ("sigmoid_fast" -> "sigmoid").
+std::string BaseNonlinearity(std::string nonlinearity);
+
+// outputs[i] = activation(inputs[i]). inputs and outputs may be the same.
+void ActivateArray(int activation, real *inputs, real *outputs, int n);
+
+// beta[i] = alpha[i] * activation'(x[i]), given outputs[i] = activation(x[i]).
+void ActivationBackwardArray(int activation, real *outputs, real *alpha, real *beta, int n);
+
+// The sigmoid table, filled by ActivationFromNonlinearity when a table
+// activation is asked for. It samples [-kSigmoidTableRange, kSigmoidTableRange].
+static const int kSigmoidTableSize = 4096;
+static const real kSigmoidTableRange = 16.;
+extern real sigmoid_table[kSigmoidTableSize+1];
+
+// A rational approximation of tanh, accurate to float precision on the clamped
+// range.
+static inline real FastTanh(real x)
+{
+  const real clamp = 7.90531110763549805;
+  if(x > clamp)
+    x = clamp;
+  else if(x < -clamp)
+    x = -clamp;
+  real x2 = x*x;
+  real p = -2.76076847742355e-16;
+  p = p*x2 + 2.00018790482477e-13;
+  p = p*x2 - 8.60467152213735e-11;
+  p = p*x2 + 5.12229709037114e-08;
+  p = p*x2 + 1.48572235717979e-05;
+  p = p*x2 + 6.37261928875436e-04;
+  p = p*x2 + 4.89352455891786e-03;
+  real q = 1.19825839466702e-06;
+  q = q*x2 + 1.18534705686654e-04;
+  q = q*x2 + 2.26843463243900e-03;
+  q = q*x2 + 4.89352518554385e-03;
+  return x*p/q;
+}
+
+static inline real TableSigmoid(real x)
+{
+  const real scale = kSigmoidTableSize / (2.*kSigmoidTableRange);
+  real pos = (x + kSigmoidTableRange) * scale;
+  if(pos <= 0.)
+    return sigmoid_table[0];
+  if(pos >= kSigmoidTableSize)
+    return sigmoid_table[kSigmoidTableSize];
+  int index = (int)pos;
+  real frac = pos - index;
+  return sigmoid_table[index] + frac * (sigmoid_table[index+1] - sigmoid_table[index]);
+}
+
+static inline real Activate(int activation, real x)
+{
+  switch(activation)    {
+    case kActivationSigmoid:
+      return 1./(1.+exp(-x));
+    case kActivationTanh:
+      return tanh(x);
+    case kActivationSoftsign:
+      return 0.5 * (x/(1.0 + fabs(x)) + 1.);
+    case kActivationSigmoidFast:
+      return 0.5 * FastTanh(0.5*x) + 0.5;
+    case kActivationTanhFast:
+      return FastTanh(x);
+    case kActivationSigmoidTable:
+      return TableSigmoid(x);
+    case kActivationTanhTable:
+      return 2. * TableSigmoid(2.*x) - 1.;
+    default:
+      return x;
+  }
+}
+
+static inline real ActivationDerivative(int activation, real y)
+{
+  switch(activation)    {
+    case kActivationSigmoid:
+    case kActivationSigmoidFast:
+    case kActivationSigmoidTable:
+      return y * (1.-y);
+    case kActivationTanh:
+    case kActivationTanhFast:
+    case kActivationTanhTable:
+      return 1. - y*y;
+    case kActivationSoftsign:
+      {
+        // 1/(1+|x|) = 1-|2y-1|
+        real z = 1. - fabs(2.*y - 1.);
+        return 0.5 * z * z;
+      }
+    default:
+      return 1.;
+  }
+}
+
+// FastTanh on all the lanes, with vector arithmetic only.
+static inline simd_real FastTanhSimd(simd_real x)
+{
+  const real clamp = 7.90531110763549805;
+  for(int k=0; k<kSimdWidth; k++)
+    x[k] = (x[k] > clamp ? clamp : (x[k] < -clamp ? -clamp : x[k]));
+  simd_real x2 = x*x;
+  simd_real p = SimdSplat(-2.76076847742355e-16);
+  p = p*x2 + (real)2.00018790482477e-13;
+  p = p*x2 - (real)8.60467152213735e-11;
+  p = p*x2 + (real)5.12229709037114e-08;
+  p = p*x2 + (real)1.48572235717979e-05;
+  p = p*x2 + (real)6.37261928875436e-04;
+  p = p*x2 + (real)4.89352455891786e-03;
+  simd_real q = SimdSplat(1.19825839466702e-06);
+  q = q*x2 + (real)1.18534705686654e-04;
+  q = q*x2 + (real)2.26843463243900e-03;
+  q = q*x2 + (real)4.89352518554385e-03;
+  return x*p/q;
+}
+
+static inline simd_real ActivateSimd(int activation, simd_real x)
+{
+  switch(activation)    {
+    case kActivationSoftsign:
+      {
+        simd_real abs_x;
+        for(int k=0; k<kSimdWidth; k++)
+          abs_x[k] = fabs(x[k]);
+        return (real)0.5 * (x/((real)1. + abs_x) + (real)1.);
+      }
+    case kActivationSigmoidFast:
+      return (real)0.5 * FastTanhSimd((real)0.5*x) + (real)0.5;
+    case kActivationTanhFast:
+      return FastTanhSimd(x);
+    default:
+      for(int k=0; k<kSimdWidth; k++)
+        x[k] = Activate(activation, x[k]);
+      return x;
+  }
+}
+
+static inline simd_real ActivationDerivativeSimd(int activation, simd_real y)
+{
+  switch(activation)    {
+    case kActivationSigmoid:
+    case kActivationSigmoidFast:
+    case kActivationSigmoidTable:
+      return y * ((real)1.-y);
+    case kActivationTanh:
+    case kActivationTanhFast:
+    case kActivationTanhTable:
+      return (real)1. - y*y;
+    case kActivationSoftsign:
+      {
+        simd_real z = (real)2.*y - (real)1.;
+        for(int k=0; k<kSimdWidth; k++)
+          z[k] = fabs(z[k]);
+        z = (real)1. - z;
+        return (real)0.5 * z * z;
+      }
+    default:
+      return SimdSplat(1.);
+  }
+}
+
+// Calls kernel<activation> args for the given activation, in a switch, so the
+// kernels can be templates on the activation.
+#define TORCH_SWITCH_ACTIVATION(activation, kernel, args) \
+  switch(activation)    { \
+    case kActivationSigmoid: kernel<kActivationSigmoid> args; break; \
+    case kActivationTanh: kernel<kActivationTanh> args; break; \
+    case kActivationSoftsign: kernel<kActivationSoftsign> args; break; \
+    case kActivationSigmoidFast: kernel<kActivationSigmoidFast> args; break; \
+    case kActivationTanhFast: kernel<kActivationTanhFast> args; break; \
+    case kActivationSigmoidTable: kernel<kActivationSigmoidTable> args; break; \
+    case kActivationTanhTable: kernel<kActivationTanhTable> args; break; \
+    default: kernel<kActivationNone> args; \
+  }
+
+}
+
+#endif  // TORCH_ACTIVATIONS_H_
@@ -6,6 +6,8 @@
 #include <fstream>
 #include <cassert>
 
+#include "parameter_arena.h"
+
 namespace Torch {
 
 int GetNParams(GradientMachine *machine)
@@ -122,12 +124,13 @@ real EvaluateGradientVarianceInDirection(GradientMachine *machine, Criterion *cr
     // Copy gradient to a vector
     int offset = 0;
     Parameters *der_params = machine->der_params;
-    for (int pg=0; pg<der_params->n_data; pg++) {   // pg = parameter group
-      for (int p=0; p<der_params->size[pg]; p++)
-        example_gradient.ptr[offset+p] = der_params->data[pg][p];
-      offset += der_params->size[pg];
+    for (int pg=0, next; pg<der_params->n_data; pg=next) {   // pg = parameter group
+      int run_size;
+      next = NextParameterRun(der_params, NULL, pg, &run_size);
+      memcpy(example_gradient.ptr+offset, der_params->data[pg], sizeof(real)*run_size);
+      offset += run_size;
       // Clear derivatives
-      memset(der_params->data[pg], 0, sizeof(real)*der_params->size[pg]);
+      memset(der_params->data[pg], 0, sizeof(real)*run_size);
     }
     // Get gradient in direction
     gradients_in_direction[i] = direction->iP(&example_gradient);
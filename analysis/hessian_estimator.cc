@@ -34,6 +34,7 @@ the pca_estimator on the gradients.\n";
 #include "ClassNLLCriterion.h"
 #include "matrix.h"
 #include "Parameters.h"
+#include "parameter_arena.h"
 #include  "communicating_stacked_autoencoder.h"
 #include "pca_estimator.h"
 #include "helpers.h"
@@ -126,11 +127,14 @@ int main(int argc, char **argv)
       criterion.backward(csae->outputs, NULL);
       csae->backward(data.inputs, criterion.beta);
     
-      // Observe the gradients - copy to sample
+      // Observe the gradients - copy to sample, one run of adjacent
+      // arrays at a time (see ParameterArena)
       int offset = 0;
-      for(int j=0; j<der_params->n_data; j++) {
-        memcpy(sample.ptr+offset, der_params->data[j], der_params->size[j] * sizeof(real));
-        offset += der_params->size[j];
+      for(int j=0, next; j<der_params->n_data; j=next) {
+        int run_size;
+        next = NextParameterRun(der_params, NULL, j, &run_size);
+        memcpy(sample.ptr+offset, der_params->data[j], run_size * sizeof(real));
+        offset += run_size;
       }
       estimator->Observe(&sample);
 
@@ -0,0 +1,282 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "cached_data_set.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+namespace Torch {
+
+CachedDataSet::CachedDataSet(DataSet *data, Machine *machine, Sequence *outputs,
+                             std::string file_name, bool copy_targets_, bool half_precision_)
+{
+  owner = this;
+  copy_targets = copy_targets_;
+  half_precision = half_precision_;
+  storage = NULL;
+  half_storage = NULL;
+  file_descriptor = -1;
+  mapping = NULL;
+  mapping_size = 0;
+  target_storage = NULL;
+  target_offsets = NULL;
+  target_n_frames = NULL;
+  max_n_target_frames = 0;
+  DataSet::init(data->n_examples, outputs->frame_size,
+                (copy_targets ? data->n_targets : outputs->frame_size));
+
+  // The layout, from the number of input frames: the machine gives one
+  // output frame per input frame.
+  example_offsets = (long*)allocator->alloc(sizeof(long)*n_examples);
+  example_n_frames = (int*)allocator->alloc(sizeof(int)*n_examples);
+  if(copy_targets)  {
+    target_offsets = (long*)allocator->alloc(sizeof(long)*n_examples);
+    target_n_frames = (int*)allocator->alloc(sizeof(int)*n_examples);
+  }
+  n_stored_reals = 0;
+  max_n_frames = 0;
+  long n_target_reals = 0;
+  for(int t=0; t<n_examples; t++)   {
+    int n_frames;
+    int n_frames_targets;
+    data->getNumberOfFrames(t, &n_frames, (copy_targets ? &n_frames_targets : NULL));
+    example_offsets[t] = n_stored_reals;
+    example_n_frames[t] = n_frames;
+    n_stored_reals += (long)n_frames*n_inputs;
+    if(n_frames > max_n_frames)
+      max_n_frames = n_frames;
+    if(copy_targets)    {
+      target_offsets[t] = n_target_reals;
+      target_n_frames[t] = n_frames_targets;
+      n_target_reals += (long)n_frames_targets*n_targets;
+      if(n_frames_targets > max_n_target_frames)
+        max_n_target_frames = n_frames_targets;
+    }
+  }
+
+  size_t element_size = (half_precision ? sizeof(uint16_t) : sizeof(real));
+  size_t n_bytes = element_size*(n_stored_reals > 0 ? n_stored_reals : 1);
+  if(file_name.empty())
+    mapping = allocator->alloc(n_bytes);
+  else  {
+    file_descriptor = open(file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if(file_descriptor < 0)
+      error("CachedDataSet: can't create %s", file_name.c_str());
+    if(ftruncate(file_descriptor, n_bytes) != 0)
+      error("CachedDataSet: can't grow %s to %ld bytes", file_name.c_str(), (long)n_bytes);
+    mapping = mmap(NULL, n_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, file_descriptor, 0);
+    if(mapping == MAP_FAILED)
+      error("CachedDataSet: can't map %s", file_name.c_str());
+    mapping_size = n_bytes;
+    unlink(file_name.c_str());
+  }
+  if(half_precision)
+    half_storage = (uint16_t*)mapping;
+  else
+    storage = (real*)mapping;
+  if(copy_targets)
+    target_storage = (real*)allocator->alloc(sizeof(real)*(n_target_reals > 0 ? n_target_reals : 1));
+
+  for(int t=0; t<n_examples; t++)   {
+    data->setExample(t, true, copy_targets);
+    machine->forward(data->inputs);
+    if(outputs->n_frames != example_n_frames[t])
+      error("CachedDataSet: example %d has %d output frames for %d input frames", t,
+            outputs->n_frames, example_n_frames[t]);
+
+    long offset = example_offsets[t];
+    for(int f=0; f<outputs->n_frames; f++)  {
+      if(half_precision)    {
+        for(int j=0; j<n_inputs; j++)
+          half_storage[offset+j] = RealToHalf(outputs->frames[f][j]);
+      } else
+        memcpy(storage+offset, outputs->frames[f], sizeof(real)*n_inputs);
+      offset += n_inputs;
+    }
+
+    if(copy_targets)    {
+      real *ptr = target_storage + target_offsets[t];
+      for(int f=0; f<target_n_frames[t]; f++)  {
+        memcpy(ptr, data->targets->frames[f], sizeof(real)*n_targets);
+        ptr += n_targets;
+      }
+    }
+  }
+
+  frame_pointers = (real**)allocator->alloc(sizeof(real*)*(max_n_frames > 0 ? max_n_frames : 1));
+  decoded_frames = NULL;
+  if(half_precision)
+    decoded_frames = (real*)allocator->alloc(sizeof(real)*((long)max_n_frames*n_inputs > 0 ? (long)max_n_frames*n_inputs : 1));
+  inputs = new(allocator) Sequence(frame_pointers, 0, n_inputs);
+  target_frame_pointers = NULL;
+  if(copy_targets)  {
+    target_frame_pointers = (real**)allocator->alloc(sizeof(real*)*(max_n_target_frames > 0 ? max_n_target_frames : 1));
+    targets = new(allocator) Sequence(target_frame_pointers, 0, n_targets);
+  } else
+    targets = inputs;
+}
+
+CachedDataSet::CachedDataSet(CachedDataSet *owner_)
+{
+  owner = owner_;
+  copy_targets = owner->copy_targets;
+  half_precision = owner->half_precision;
+  file_descriptor = -1;
+  mapping = NULL;
+  mapping_size = 0;
+  DataSet::init(owner->n_examples, owner->n_inputs, owner->n_targets);
+  storage = owner->storage;
+  half_storage = owner->half_storage;
+  n_stored_reals = owner->n_stored_reals;
+  example_offsets = owner->example_offsets;
+  example_n_frames = owner->example_n_frames;
+  max_n_frames = owner->max_n_frames;
+  target_storage = owner->target_storage;
+  target_offsets = owner->target_offsets;
+  target_n_frames = owner->target_n_frames;
+  max_n_target_frames = owner->max_n_target_frames;
+
+  frame_pointers = (real**)allocator->alloc(sizeof(real*)*(max_n_frames > 0 ? max_n_frames : 1));
+  decoded_frames = NULL;
+  if(half_precision)
+    decoded_frames = (real*)allocator->alloc(sizeof(real)*((long)max_n_frames*n_inputs > 0 ? (long)max_n_frames*n_inputs : 1));
+  inputs = new(allocator) Sequence(frame_pointers, 0, n_inputs);
+  target_frame_pointers = NULL;
+  if(copy_targets)  {
+    target_frame_pointers = (real**)allocator->alloc(sizeof(real*)*(max_n_target_frames > 0 ? max_n_target_frames : 1));
+    targets = new(allocator) Sequence(target_frame_pointers, 0, n_targets);
+  } else
+    targets = inputs;
+}
+
+void CachedDataSet::getNumberOfFrames(int t_, int *n_input_frames_, int *n_target_frames_)
+{
+  int t = selected_examples[t_];
+  if(n_input_frames_)
+    *n_input_frames_ = example_n_frames[t];
+  if(n_target_frames_)
+    *n_target_frames_ = (copy_targets ? target_n_frames[t] : example_n_frames[t]);
+}
+
+void CachedDataSet::setRealExample(int t, bool set_inputs, bool set_targets)
+{
+  long offset = example_offsets[t];
+  for(int f=0; f<example_n_frames[t]; f++)  {
+    if(half_precision)  {
+      real *frame = decoded_frames + (long)f*n_inputs;
+      for(int j=0; j<n_inputs; j++)
+        frame[j] = HalfToReal(half_storage[offset+j]);
+      frame_pointers[f] = frame;
+    } else
+      frame_pointers[f] = storage + offset;
+    offset += n_inputs;
+  }
+  inputs->n_frames = example_n_frames[t];
+
+  if(copy_targets)  {
+    real *ptr = target_storage + target_offsets[t];
+    for(int f=0; f<target_n_frames[t]; f++)
+      target_frame_pointers[f] = ptr + (long)f*n_targets;
+    targets->n_frames = target_n_frames[t];
+  }
+  real_current_example_index = t;
+}
+
+void CachedDataSet::preProcess(PreProcessing *pre_processing)
+{
+  error("CachedDataSet: pre-processing not supported");
+}
+
+void CachedDataSet::pushExample()
+{
+  error("CachedDataSet::pushExample()  not supported");
+}
+
+void CachedDataSet::popExample()
+{
+  error("CachedDataSet::popExample()  not supported");
+}
+
+// The views don't own the storage.
+CachedDataSet::~CachedDataSet()
+{
+  if(owner == this && file_descriptor >= 0)   {
+    munmap(mapping, mapping_size);
+    close(file_descriptor);
+  }
+}
+
+uint16_t RealToHalf(real x)
+{
+  float f = (float)x;
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  uint32_t sign = (bits >> 16) & 0x8000;
+  int exponent = (int)((bits >> 23) & 0xff);
+  uint32_t mantissa = bits & 0x7fffff;
+
+  // Infinities and NaNs
+  if(exponent == 0xff)
+    return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+
+  int half_exponent = exponent - 127 + 15;
+  if(half_exponent >= 31)
+    return sign | 0x7c00;
+
+  // Subnormal halves, from 2^-24 on.
+  if(half_exponent <= 0)    {
+    if(half_exponent < -10)
+      return sign;
+    mantissa |= 0x800000;
+    int shift = 14 - half_exponent;
+    uint32_t half_mantissa = mantissa >> shift;
+    uint32_t rest = mantissa & ((1u << shift) - 1);
+    uint32_t halfway = 1u << (shift - 1);
+    if(rest > halfway || (rest == halfway && (half_mantissa & 1)))
+      half_mantissa++;
+    return sign | half_mantissa;
+  }
+
+  // A carry of the rounding goes into the exponent, as it should.
+  uint32_t half = sign | (half_exponent << 10) | (mantissa >> 13);
+  uint32_t rest = mantissa & 0x1fff;
+  if(rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+    half++;
+  return half;
+}
+
+real HalfToReal(uint16_t h)
+{
+  uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+  int exponent = (h >> 10) & 0x1f;
+  uint32_t mantissa = h & 0x3ff;
+
+  if(exponent == 0)     {
+    real value = ldexp((real)mantissa, -24);
+    return (sign ? -value : value);
+  }
+
+  uint32_t bits;
+  if(exponent == 31)
+    bits = sign | 0x7f800000 | (mantissa << 13);
+  else
+    bits = sign | ((uint32_t)(exponent + 112) << 23) | (mantissa << 13);
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+}
@@ -0,0 +1,98 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_CACHED_DATA_SET_H_
+#define TORCH_CACHED_DATA_SET_H_
+
+#include <string>
+#include <stdint.h>
+#include "DataSet.h"
+#include "Machine.h"
+
+namespace Torch {
+
+// The outputs of a machine on every example of a DataSet, computed once and
+// stored, so that the layers trained on top of a frozen machine don't run
+// it at each epoch.
+//
+// The examples have the outputs as inputs. Their targets are the outputs as
+// well, like with an InputAsTargetDataSet, or a copy of the targets of the
+// DataSet (#copy_targets#), e.g. for supervised training.
+//
+// The outputs are kept in memory, or in a file mapped in memory if a file
+// name is given. The file is removed once mapped: it only lives as long as
+// the cache. With #half_precision#, they are stored as IEEE half floats and
+// converted back when an example is set.
+//
+// The frames handed out may point into the cache: they must not be modified.
+//
+class CachedDataSet : public DataSet
+{
+  private:
+    CachedDataSet(){};
+
+  public:
+    // The cache, shared by the views (see below). One of storage and
+    // half_storage is used.
+    CachedDataSet *owner;
+    bool half_precision;
+    real *storage;
+    uint16_t *half_storage;
+    long n_stored_reals;
+    long *example_offsets;
+    int *example_n_frames;
+    int max_n_frames;
+    // The mapping, if the cache is in a file.
+    int file_descriptor;
+    void *mapping;
+    size_t mapping_size;
+
+    // The copied targets, if any.
+    bool copy_targets;
+    real *target_storage;
+    long *target_offsets;
+    int *target_n_frames;
+    int max_n_target_frames;
+
+    // The current example.
+    real **frame_pointers;
+    real *decoded_frames;
+    real **target_frame_pointers;
+
+    // Forwards #machine# on the inputs of each example of #data# and stores
+    // #outputs# (#machine#'s outputs, or a Sequence it fills).
+    CachedDataSet(DataSet *data, Machine *machine, Sequence *outputs,
+                  std::string file_name="", bool copy_targets_=false,
+                  bool half_precision_=false);
+    // Another view of the cache of #owner_#, with its own current example,
+    // e.g. for a thread.
+    CachedDataSet(CachedDataSet *owner_);
+
+    virtual void getNumberOfFrames(int t_, int *n_input_frames_, int *n_target_frames_);
+    virtual void setRealExample(int t, bool set_inputs=true, bool set_targets=true);
+    virtual void preProcess(PreProcessing *pre_processing);
+    virtual void pushExample();
+    virtual void popExample();
+
+    virtual ~CachedDataSet();
+};
+
+// Conversions between reals and IEEE half floats, rounding to nearest even.
+// Out of range values become infinities.
+uint16_t RealToHalf(real x);
+real HalfToReal(uint16_t h);
+
+}
+
+#endif // TORCH_CACHED_DATA_SET_H_
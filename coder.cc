@@ -23,13 +23,15 @@
 #include "destructive.h"
 #include "transposed_tied_linear.h"
 #include "nonlinear.h"
+#include "activation_layer.h"
 #include "smoothed_linear.h"
+#include "linear_kernels.h"
 
 namespace Torch {
 
 Coder::Coder(int n_inputs_, int n_outputs_, bool is_noisy_,
               Coder *tied_coder_, bool is_transposed_, bool reparametrize_,
-              std::string nonlinearity_, bool layer_smoothed_)
+              std::string nonlinearity_, bool layer_smoothed_, Coder *params_owner_)
     : GradientMachine(n_inputs_, n_outputs_, 0)
 {
   is_noisy = is_noisy_;
@@ -38,6 +40,31 @@ Coder::Coder(int n_inputs_, int n_outputs_, bool is_noisy_,
   reparametrize = reparametrize_;
   nonlinearity = nonlinearity_;
   layer_smoothed = layer_smoothed_;
+  params_owner = params_owner_;
+  fused_activation = ActivationFromNonlinearity(nonlinearity);
+  alpha_on_pre_activations = false;
+  n_forwards = 0;
+  l1_weight_decay = 0.;
+  l2_weight_decay = 0.;
+  bias_decay = 0.;
+  decay_log_scale = 0.;
+  decay_l1_shrink = 0.;
+  column_log_scale = NULL;
+  column_l1_shrink = NULL;
+  weights_caught_up = true;
+  derivatives_touched = true;
+  backpropagated = false;
+
+  used_sparse_kernels = false;
+  n_sparse_frames = 0;
+  sparse_index_buffer = NULL;
+  sparse_value_buffer = NULL;
+  sparse_indices = NULL;
+  sparse_values = NULL;
+  n_nonzeros = NULL;
+  beta_only_alphas = NULL;
+  addROption("sparse threshold", &sparse_threshold, 1.,
+             "fraction of zero inputs from which the sparse kernels are used (1 to never use them)");
 
   // Build the underlying machines.
   BuildDestructiveLayer();
@@ -124,6 +151,26 @@ void Coder::BuildLinearLayer()
       error("Coder::Coder(...) - weights cannot be transposed unless tied (no code for it)!");
     }
   }
+
+  // A replica tied without transposition already uses the weights of its
+  // tied coder, which is a replica as well.
+  if(params_owner && !(tied_coder && !is_transposed))
+    ShareLinearParameters();
+}
+
+void Coder::ShareLinearParameters()
+{
+  Linear *owner_layer = params_owner->linear_layer;
+  if(linear_layer->params->n_data != owner_layer->params->n_data)
+    error("Coder::ShareLinearParameters() - the owner has a different linear layer.");
+
+  // For a TransposedTiedLinear, only the bias is in params. The weights are
+  // already the owner's through the tied coder.
+  linear_layer->allocator->free(linear_layer->params);
+  linear_layer->params = new(linear_layer->allocator) Parameters(0);
+  linear_layer->params->add(owner_layer->params);
+  linear_layer->weights = owner_layer->weights;
+  linear_layer->bias = owner_layer->bias;
 }
 
 void Coder::BuildNonlinearLayer()
@@ -138,6 +185,9 @@ void Coder::BuildNonlinearLayer()
     nonlinear_layer = new(allocator)Nonlinear(n_outputs);
   }     else if(nonlinearity=="logsoftmax")       {
     nonlinear_layer = new(allocator)LogSoftMax(n_outputs);
+  }     else if(ActivationFromNonlinearity(nonlinearity) != kActivationNone)       {
+    // The approximate activations: "sigmoid_fast", "tanh_table", ...
+    nonlinear_layer = new(allocator)ActivationLayer(n_outputs, ActivationFromNonlinearity(nonlinearity));
   }     else    {
     error("Coder::Coder(...) - Unrecognized nonlinearity!");
   }
@@ -153,13 +203,321 @@ void Coder::setPartialBackprop(bool flag)
     linear_layer->setPartialBackprop(flag);
 }
 
+// The criterion needs the pre-activations, so the activation is not fused
+// anymore.
+void Coder::setAlphaOnPreActivations(bool flag)
+{
+  alpha_on_pre_activations = flag;
+  if(flag)
+    fused_activation = kActivationNone;
+  else
+    fused_activation = ActivationFromNonlinearity(nonlinearity);
+}
+
+void Coder::setL1WeightDecay(real weight_decay)
+{
+  l1_weight_decay = weight_decay;
+}
+
+void Coder::setL2WeightDecay(real weight_decay)
+{
+  l2_weight_decay = weight_decay;
+}
+
+void Coder::setBiasDecay(real bias_decay_)
+{
+  bias_decay = bias_decay_;
+}
+
+void Coder::CopySettings(Coder *from)
+{
+  l1_weight_decay = from->l1_weight_decay;
+  l2_weight_decay = from->l2_weight_decay;
+  bias_decay = from->bias_decay;
+  sparse_threshold = from->sparse_threshold;
+
+  if(destructive_layer && from->destructive_layer)      {
+    destructive_layer->destruct_prob = from->destructive_layer->destruct_prob;
+    destructive_layer->destruct_value = from->destructive_layer->destruct_value;
+  }
+
+  if(layer_smoothed && from->layer_smoothed)    {
+    SmoothedLinear *sl = (SmoothedLinear*)linear_layer;
+    SmoothedLinear *from_sl = (SmoothedLinear*)from->linear_layer;
+    sl->input_sub_unit_size = from_sl->input_sub_unit_size;
+    sl->input_n_sub_units = from_sl->input_n_sub_units;
+    sl->l1_smoothing_weight_decay = from_sl->l1_smoothing_weight_decay;
+    sl->l2_smoothing_weight_decay = from_sl->l2_smoothing_weight_decay;
+  }
+}
+
+Coder *Coder::WeightOwner()
+{
+  if(tied_coder)
+    return tied_coder->WeightOwner();
+  return this;
+}
+
+// By range: Linear keeps its bias in the same array as its weights.
+static bool HoldsData(Parameters *params, real *data)
+{
+  if(!data)
+    return false;
+  for(int i=0; i<params->n_data; i++)   {
+    if(data >= params->data[i] && data < params->data[i]+params->size[i])
+      return true;
+  }
+  return false;
+}
+
+// Scales w, then shrinks it towards 0 by shrink (without crossing 0).
+static inline real DecayWeight(real w, real scale, real shrink)
+{
+  w *= scale;
+  if(shrink > 0.)       {
+    if(w > shrink)
+      w -= shrink;
+    else if(w < -shrink)
+      w += shrink;
+    else
+      w = 0.;
+  }
+  return w;
+}
+
+// The decays of several updates are applied at once as one scaling and one
+// shrinking. This is exact for an L2 or an L1 decay alone, and only differs by
+// second order terms in the learning rate when they are combined. The bias is
+// small and always read: it is decayed right away.
+//
+// The coders whose parameters are updated without having been backpropagated
+// (e.g. the lower encoders when training a layer) are not decayed. A tied
+// coder only decays its own bias, if it has one: the weights are decayed by
+// the coder owning them.
+void Coder::ApplyWeightDecay(Parameters *updated_params, real learning_rate)
+{
+  if(!updated_params)
+    return;
+
+  bool own_bias = !tied_coder || is_transposed;
+  bool updated_bias = own_bias && HoldsData(updated_params, linear_layer->bias);
+  bool updated_weights = !tied_coder && HoldsData(updated_params, linear_layer->weights);
+  if(!updated_bias && !updated_weights)
+    return;
+
+  // backward also flags the encoder of a tied decoder, whose weights it uses.
+  bool trained = backpropagated;
+  backpropagated = false;
+  if(!trained)
+    return;
+
+  if(bias_decay != 0. && updated_bias)  {
+    real scale = 1. - learning_rate*bias_decay;
+    for(int o=0; o<n_outputs; o++)
+      linear_layer->bias[o] *= scale;
+  }
+
+  if((l1_weight_decay == 0. && l2_weight_decay == 0.) || !updated_weights)
+    return;
+
+  Coder *owner = WeightOwner();
+  if(!owner->column_log_scale)  {
+    owner->column_log_scale = (double*)owner->allocator->alloc(sizeof(double)*owner->n_inputs);
+    owner->column_l1_shrink = (double*)owner->allocator->alloc(sizeof(double)*owner->n_inputs);
+    for(int i=0; i<owner->n_inputs; i++)  {
+      owner->column_log_scale[i] = owner->decay_log_scale;
+      owner->column_l1_shrink[i] = owner->decay_l1_shrink;
+    }
+  }
+
+  // A learning rate so large that the weights vanish.
+  real scale = 1. - learning_rate*l2_weight_decay;
+  if(scale < 1e-30)
+    scale = 1e-30;
+  owner->decay_log_scale += log(scale);
+  owner->decay_l1_shrink += learning_rate*l1_weight_decay;
+  owner->weights_caught_up = false;
+}
+
+// Goes through the weights row by row. The column arrays are used to hold
+// the scale and shrink of each column in the meantime.
+void Coder::FlushWeightDecay()
+{
+  if(weights_caught_up)
+    return;
+
+  for(int i=0; i<n_inputs; i++) {
+    column_log_scale[i] = exp(decay_log_scale - column_log_scale[i]);
+    column_l1_shrink[i] = decay_l1_shrink - column_l1_shrink[i];
+  }
+
+  real *weights = linear_layer->weights;
+  for(int o=0; o<n_outputs; o++)  {
+    real *row = weights + o*n_inputs;
+    for(int i=0; i<n_inputs; i++)
+      row[i] = DecayWeight(row[i], column_log_scale[i], column_l1_shrink[i]);
+  }
+
+  for(int i=0; i<n_inputs; i++) {
+    column_log_scale[i] = decay_log_scale;
+    column_l1_shrink[i] = decay_l1_shrink;
+  }
+  weights_caught_up = true;
+}
+
+// A column that appears in several frames is only caught up once.
+void Coder::CatchUpWeightDecay(int **indices, int *n_nonzeros_, int n_frames)
+{
+  if(weights_caught_up)
+    return;
+
+  real *weights = linear_layer->weights;
+  for(int f=0; f<n_frames; f++) {
+    for(int k=0; k<n_nonzeros_[f]; k++)   {
+      int i = indices[f][k];
+      double log_scale = decay_log_scale - column_log_scale[i];
+      double shrink = decay_l1_shrink - column_l1_shrink[i];
+      if(log_scale == 0. && shrink == 0.)
+        continue;
+      real scale = exp(log_scale);
+      for(int o=0; o<n_outputs; o++)
+        weights[o*n_inputs+i] = DecayWeight(weights[o*n_inputs+i], scale, shrink);
+      column_log_scale[i] = decay_log_scale;
+      column_l1_shrink[i] = decay_l1_shrink;
+    }
+  }
+}
+
+// A fused activation or sparse inputs need the kernels even for one frame. The
+// smoothing decay of a SmoothedLinear is added at update time, so it doesn't
+// matter here.
+bool Coder::UseFrameKernels(int n_frames)
+{
+  return (n_frames > 1) || (fused_activation != kActivationNone) || used_sparse_kernels;
+}
+
+// Only the Linear layout has sparse kernels. The inputs of the transposed
+// decoders are codes, which are rarely exactly zero.
+bool Coder::UseSparseKernels(Sequence *inputs)
+{
+  if((tied_coder && is_transposed) || sparse_threshold >= 1.)
+    return false;
+
+  int n_frames = inputs->n_frames;
+  if(n_frames > n_sparse_frames)  {
+    n_sparse_frames = n_frames;
+    sparse_index_buffer = (int*)allocator->realloc(sparse_index_buffer, sizeof(int)*n_inputs*n_frames);
+    sparse_value_buffer = (real*)allocator->realloc(sparse_value_buffer, sizeof(real)*n_inputs*n_frames);
+    sparse_indices = (int**)allocator->realloc(sparse_indices, sizeof(int*)*n_frames);
+    sparse_values = (real**)allocator->realloc(sparse_values, sizeof(real*)*n_frames);
+    n_nonzeros = (int*)allocator->realloc(n_nonzeros, sizeof(int)*n_frames);
+    for(int f=0; f<n_frames; f++) {
+      sparse_indices[f] = sparse_index_buffer + f*n_inputs;
+      sparse_values[f] = sparse_value_buffer + f*n_inputs;
+    }
+  }
+
+  // The scan is cheap next to the dense product.
+  int n_nonzeros_total = 0;
+  for(int f=0; f<n_frames; f++) {
+    n_nonzeros[f] = GatherNonzeros(inputs->frames[f], n_inputs, sparse_indices[f], sparse_values[f]);
+    n_nonzeros_total += n_nonzeros[f];
+  }
+  real sparsity = 1. - (real)n_nonzeros_total / (real)(n_inputs*n_frames);
+  return sparsity >= sparse_threshold;
+}
+
+// With a fused activation, the outputs of the nonlinear layer are written
+// directly and those of the linear layer are left alone.
+void Coder::ForwardLinearFrames(Sequence *inputs)
+{
+  int n_frames = inputs->n_frames;
+  Sequence *outputs_ = linear_layer->outputs;
+  if(fused_activation != kActivationNone)
+    outputs_ = nonlinear_layer->outputs;
+  outputs_->resize(n_frames);
+
+  if(tied_coder && is_transposed)       {
+    TransposedTiedLinear *ttl = (TransposedTiedLinear*)linear_layer;
+    // Like TransposedTiedLinear::frameForward, the bias only enters with the
+    // reparametrization.
+    TransposedLinearForwardFrames(ttl->weights,
+                                  ttl->reparametrize ? ttl->bias : NULL,
+                                  ttl->reparametrize ? ttl->reparametrization_multiplier : 1.,
+                                  n_inputs, n_outputs,
+                                  inputs->frames, outputs_->frames, n_frames, fused_activation);
+  }     else if(used_sparse_kernels)    {
+    LinearSparseForwardFrames(linear_layer->weights, linear_layer->bias, n_inputs, n_outputs,
+                              sparse_indices, sparse_values, n_nonzeros,
+                              outputs_->frames, n_frames, fused_activation);
+  }     else    {
+    LinearForwardFrames(linear_layer->weights, linear_layer->bias, n_inputs, n_outputs,
+                        inputs->frames, outputs_->frames, n_frames, fused_activation);
+  }
+}
+
+// With a fused activation, alpha is with respect to the outputs of the
+// nonlinear layer.
+void Coder::BackwardLinearFrames(Sequence *inputs, Sequence *alpha)
+{
+  int n_frames = inputs->n_frames;
+  linear_layer->beta->resize(n_frames);
+  real **betas = (linear_layer->partial_backprop ? NULL : linear_layer->beta->frames);
+
+  // The betas read all the weights, not only those of the nonzero inputs.
+  if(used_sparse_kernels && betas)
+    WeightOwner()->FlushWeightDecay();
+  real **outputs_ = NULL;
+  if(fused_activation != kActivationNone)
+    outputs_ = nonlinear_layer->outputs->frames;
+
+  if(tied_coder && is_transposed)       {
+    TransposedTiedLinear *ttl = (TransposedTiedLinear*)linear_layer;
+    TransposedLinearBackwardFrames(ttl->weights, ttl->der_weights, ttl->der_bias,
+                                   ttl->reparametrize ? ttl->reparametrization_multiplier : 1.,
+                                   n_inputs, n_outputs,
+                                   inputs->frames, alpha->frames, betas, n_frames,
+                                   outputs_, fused_activation);
+  }     else    {
+    if(used_sparse_kernels)
+      LinearSparseBackwardFrames(linear_layer->weights, linear_layer->der_weights, linear_layer->der_bias,
+                                 n_inputs, n_outputs,
+                                 sparse_indices, sparse_values, n_nonzeros,
+                                 alpha->frames, betas, n_frames,
+                                 outputs_, fused_activation);
+    else
+      LinearBackwardFrames(linear_layer->weights, linear_layer->der_weights, linear_layer->der_bias,
+                           n_inputs, n_outputs,
+                           inputs->frames, alpha->frames, betas, n_frames,
+                           outputs_, fused_activation);
+  }
+}
+
 void Coder::forward(Sequence *inputs)
 {
+  n_forwards++;
+
+  Sequence *linear_inputs = inputs;
   if(destructive_layer) {
     destructive_layer->forward(inputs);
-    linear_layer->forward(destructive_layer->outputs);
+    linear_inputs = destructive_layer->outputs;
+  }
+
+  // Also used by the following backward.
+  used_sparse_kernels = UseSparseKernels(linear_inputs);
+
+  // Only the weights about to be read need to be up to date.
+  if(used_sparse_kernels)
+    WeightOwner()->CatchUpWeightDecay(sparse_indices, n_nonzeros, linear_inputs->n_frames);
+  else
+    WeightOwner()->FlushWeightDecay();
+
+  if(UseFrameKernels(linear_inputs->n_frames))  {
+    ForwardLinearFrames(linear_inputs);
+    if(fused_activation != kActivationNone)
+      return;
   }     else    {
-    linear_layer->forward(inputs);
+    linear_layer->forward(linear_inputs);
   }
 
   if(nonlinear_layer)
@@ -170,23 +528,38 @@ void Coder::forward(Sequence *inputs)
 // false.
 void Coder::backward(Sequence *inputs, Sequence *alpha)
 {
-  if(nonlinear_layer)   {
-    nonlinear_layer->backward(linear_layer->outputs, alpha);
-    if(destructive_layer)       {
-      linear_layer->backward(destructive_layer->outputs, nonlinear_layer->beta);
-      destructive_layer->backward(inputs, linear_layer->beta);
-    }   else    {
-      linear_layer->backward(inputs, nonlinear_layer->beta);
-    }
+  // A tied linear layer adds to the der_weights of the tied coder.
+  derivatives_touched = true;
+  backpropagated = true;
+  if(tied_coder)  {
+    tied_coder->derivatives_touched = true;
+    tied_coder->backpropagated = true;
+  }
+
+  Sequence *linear_inputs = inputs;
+  if(destructive_layer)
+    linear_inputs = destructive_layer->outputs;
+
+  if(UseFrameKernels(linear_inputs->n_frames)
+     && fused_activation != kActivationNone)    {
+    // The activation derivative is applied inside the kernel.
+    BackwardLinearFrames(linear_inputs, alpha);
   }     else    {
-    if(destructive_layer)       {
-      linear_layer->backward(destructive_layer->outputs, alpha);
-      destructive_layer->backward(inputs, linear_layer->beta);
-    }   else    {
-      linear_layer->backward(inputs, alpha);
+    Sequence *linear_alpha = alpha;
+    if(nonlinear_layer && !alpha_on_pre_activations)   {
+      nonlinear_layer->backward(linear_layer->outputs, alpha);
+      linear_alpha = nonlinear_layer->beta;
     }
+
+    if(UseFrameKernels(linear_inputs->n_frames))
+      BackwardLinearFrames(linear_inputs, linear_alpha);
+    else
+      linear_layer->backward(linear_inputs, linear_alpha);
   }
 
+  if(destructive_layer)
+    destructive_layer->backward(inputs, linear_layer->beta);
+
   // clear beta
   if(partial_backprop)  {
     for(int i=0; i<beta->n_frames; i++)
@@ -196,6 +569,55 @@ void Coder::backward(Sequence *inputs, Sequence *alpha)
 
 }
 
+void Coder::BackwardBeta(Sequence *alpha, Sequence *beta_)
+{
+  int n_frames = alpha->n_frames;
+  beta_->resize(n_frames);
+
+  // The alphas with respect to the outputs of the linear layer.
+  Sequence *linear_alpha = alpha;
+  if(alpha_on_pre_activations || !nonlinear_layer)      {
+    // Nothing to do.
+  }     else if(fused_activation != kActivationNone)   {
+    if(!beta_only_alphas)
+      beta_only_alphas = new(allocator) Sequence(0, n_outputs);
+    beta_only_alphas->resize(n_frames);
+    for(int t=0; t<n_frames; t++)
+      ActivationBackwardArray(fused_activation, outputs->frames[t], alpha->frames[t],
+                              beta_only_alphas->frames[t], n_outputs);
+    linear_alpha = beta_only_alphas;
+  }     else    {
+    // The nonlinear layers have no parameters, and their beta is not read
+    // after the backward of the coder.
+    nonlinear_layer->backward(linear_layer->outputs, alpha);
+    linear_alpha = nonlinear_layer->beta;
+  }
+
+  // Like the backward, the betas read all the weights.
+  if(used_sparse_kernels)
+    WeightOwner()->FlushWeightDecay();
+
+  // W^T z is the forward of the other layout.
+  if(tied_coder && is_transposed)       {
+    TransposedTiedLinear *ttl = (TransposedTiedLinear*)linear_layer;
+    LinearForwardFrames(ttl->weights, NULL, n_outputs, n_inputs,
+                        linear_alpha->frames, beta_->frames, n_frames);
+    if(ttl->reparametrize)      {
+      for(int t=0; t<n_frames; t++)
+        for(int j=0; j<n_inputs; j++)
+          beta_->frames[t][j] *= ttl->reparametrization_multiplier;
+    }
+  }     else    {
+    TransposedLinearForwardFrames(linear_layer->weights, NULL, 1., n_outputs, n_inputs,
+                                  linear_alpha->frames, beta_->frames, n_frames);
+  }
+
+  if(destructive_layer) {
+    for(int t=0; t<n_frames; t++)
+      destructive_layer->frameBackward(t, NULL, beta_->frames[t], NULL, beta_->frames[t]);
+  }
+}
+
 void Coder::loadXFile(XFile *file)
 {
   if(destructive_layer)
@@ -209,6 +631,8 @@ void Coder::loadXFile(XFile *file)
 
 void Coder::saveXFile(XFile *file)
 {
+  WeightOwner()->FlushWeightDecay();
+
   if(destructive_layer)
     destructive_layer->saveXFile(file);
 
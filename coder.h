@@ -29,6 +29,24 @@ class Destructive;
 // See backward(). This is like in ConnectedMachine: the inner machines' inputs
 // are not recomputed from the inputs given in backward.
 //
+// When given a Sequence of several frames (a minibatch), the linear layer is
+// computed by the blocked kernels of linear_kernels.h rather than frame by
+// frame, so its weights are read once for all the frames.
+//
+// The sigmoid, tanh and "nonlinear" activations are fused into these kernels:
+// the nonlinear layer is then only used for its outputs Sequence, and the
+// outputs of the linear layer are not computed.
+//
+// Inputs that are mostly zeros, such as binary images corrupted to 0, go
+// through sparse kernels that skip the weights of the zero inputs. See the
+// "sparse threshold" option, which leaves them off by default.
+//
+// The weight decays are not added to the gradient in backward but applied by
+// the trainer at update time (see ApplyWeightDecay), once per update. The
+// weight decay is lazy: it is accumulated per input column and a column only
+// catches up when its weights are read, so an update can leave the weights of
+// the zero inputs alone.
+//
 class Coder : public GradientMachine
 {
   public:
@@ -40,6 +58,67 @@ class Coder : public GradientMachine
    std::string nonlinearity;
    bool layer_smoothed;
 
+   // The activation applied by the linear kernels (see activations.h), or
+   // kActivationNone if the nonlinear layer is run separately.
+   int fused_activation;
+
+   // If true, the alpha given to backward is with respect to the outputs of
+   // the linear layer, which are then kept: the criterion has done the
+   // backward of the nonlinearity (see SigmoidCrossEntropyCriterion).
+   bool alpha_on_pre_activations;
+
+   // Number of forwards done, so that what is computed from the outputs can
+   // tell if it is current (see SoftmaxNLLCriterion).
+   int n_forwards;
+
+   // The weight decays of the linear layer. They are not options of the
+   // linear layer anymore: set them through the setters below.
+   real l1_weight_decay;
+   real l2_weight_decay;
+   real bias_decay;
+
+   // The lazy weight decay state, in the coder that owns the weights (see
+   // WeightOwner). decay_log_scale is the sum over the updates of
+   // log(1 - learning_rate*l2_weight_decay) and decay_l1_shrink the sum of
+   // learning_rate*l1_weight_decay. The column arrays hold their values when
+   // the column was last caught up.
+   double decay_log_scale;
+   double decay_l1_shrink;
+   double *column_log_scale;
+   double *column_l1_shrink;
+   bool weights_caught_up;
+
+   // False while the der_params of the linear layer are known to be zero:
+   // set by backward, and reset by the trainers when they clear them (see
+   // StackedAutoencoder::FindTouchedArrays).
+   bool derivatives_touched;
+
+   // Set by backward, and reset by ApplyWeightDecay once the coder's
+   // parameters are updated: the decays only apply to the coders that were
+   // trained, so that the frozen layers of a machine keep their parameters.
+   bool backpropagated;
+
+   // When the fraction of zeros in the inputs of the linear layer reaches
+   // sparse_threshold, the sparse kernels are used, with the nonzero inputs
+   // gathered below (one list per frame). Only for the Linear layout.
+   real sparse_threshold;
+   bool used_sparse_kernels;      // by the last forward
+   int n_sparse_frames;
+   int *sparse_index_buffer;
+   real *sparse_value_buffer;
+   int **sparse_indices;
+   real **sparse_values;
+   int *n_nonzeros;
+
+   // The alphas with respect to the pre-activations, for BackwardBeta.
+   Sequence *beta_only_alphas;
+
+   // In an execution context of params_owner (see
+   // StackedAutoencoder::NewExecutionContext), the coder reads and updates
+   // the weights and bias of params_owner, but has its own derivatives and
+   // buffers.
+   Coder *params_owner;
+
    // The underlying machines
    Destructive *destructive_layer;
    Linear *linear_layer;
@@ -48,16 +127,51 @@ class Coder : public GradientMachine
 
    Coder(int n_inputs_, int n_outputs_, bool is_noisy_,
          Coder *tied_coder_, bool is_transposed_, bool reparametrize_, std::string nonlinearity_,
-         bool layer_smoothed_=false);
+         bool layer_smoothed_=false, Coder *params_owner_=NULL);
 
    void BuildDestructiveLayer();
    void BuildLinearLayer();
+   // Points the parameters of the linear layer to the ones of params_owner.
+   void ShareLinearParameters();
    void BuildNonlinearLayer();
 
    virtual void setPartialBackprop(bool flag=true);
+   virtual void setAlphaOnPreActivations(bool flag=true);
+
+   virtual void setL1WeightDecay(real weight_decay);
+   virtual void setL2WeightDecay(real weight_decay);
+   virtual void setBiasDecay(real bias_decay_);
+   // Takes the decays, corruption, smoothing and sparsity settings of #from#,
+   // e.g. for an execution context of it (see params_owner).
+   virtual void CopySettings(Coder *from);
+
+   // The coder whose linear layer owns the weights (itself if not tied).
+   virtual Coder *WeightOwner();
+   // Called by the trainers after an update of #updated_params# with the
+   // gradient averaged over the examples: decays the weights and bias if
+   // they are among these parameters. learning_rate is the one of one
+   // example.
+   virtual void ApplyWeightDecay(Parameters *updated_params, real learning_rate);
+   // Brings the pending decay into the weights, for all the columns or only
+   // for the nonzero inputs of the given frames.
+   virtual void FlushWeightDecay();
+   virtual void CatchUpWeightDecay(int **indices, int *n_nonzeros, int n_frames);
+
+   // Multi-frame path for the linear layer.
+   virtual bool UseFrameKernels(int n_frames);
+   // Gathers the nonzero inputs and tells whether they are sparse enough.
+   virtual bool UseSparseKernels(Sequence *inputs);
+   virtual void ForwardLinearFrames(Sequence *inputs);
+   virtual void BackwardLinearFrames(Sequence *inputs, Sequence *alpha);
 
    virtual void forward(Sequence *inputs);
    virtual void backward(Sequence *inputs, Sequence *alpha);
+   // Writes in #beta_# what backward would put in beta for #alpha#, without
+   // touching the derivatives nor the beta of the coder. Must follow the
+   // forward, like backward. As backprop is linear in alpha, this gives the
+   // part of the beta due to one of several costs (see the gradient
+   // profiling of the trainers).
+   virtual void BackwardBeta(Sequence *alpha, Sequence *beta_);
 
    virtual void loadXFile(XFile *file);
    virtual void saveXFile(XFile *file);
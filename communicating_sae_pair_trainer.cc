@@ -28,10 +28,12 @@
 #include "input_as_target_data_set.h"
 #include "dynamic_data_set.h"
 #include "communicating_stacked_autoencoder.h"
+#include "parameter_arena.h"
 #include "concat_criterion.h"
 #include "statistics_measurer.h"
 #include "vectors_angle_measurer.h"
 #include "fake_data_measurer.h"
+#include "derivatives_reader.h"
 
 namespace Torch {
 
@@ -42,6 +44,7 @@ CommunicatingSaePairTrainer::CommunicatingSaePairTrainer(std::string expdir_, in
   expdir = expdir_;
   communication_type = communication_type_;
   profile_local_gradients = profile_local_gradients_;
+  profiled_betas = NULL;
 
   // Must be set prior to calling a training function
   first_csae = NULL;
@@ -253,6 +256,17 @@ void CommunicatingSaePairTrainer::trainMentoring(DataSet *sup_train_data, Measur
   real prev_err = INF;
   real current_learning_rate = learning_rate;
   int n_train = sup_train_data->n_examples;
+  n_cleared_machines = 0;
+
+  if(communication_type==0)
+    PrepareOptimizer(second_csae->sup_unsup_comA_machine);
+  else if(communication_type==1)
+    PrepareOptimizer(second_csae->sup_unsup_comB_machine);
+  else  {
+    PrepareOptimizer(first_csae->mentor_communicator);
+    PrepareOptimizer(second_csae->sup_unsup_comC_machine);
+  }
+  optimizer->Reset();
   int *shuffle = (int *)Allocator::sysAlloc(n_train*sizeof(int));
 
   // data??
@@ -304,6 +318,8 @@ void CommunicatingSaePairTrainer::trainMentoring(DataSet *sup_train_data, Measur
   Allocator *second_allocator_ = extractMeasurers(student_measurers_all, second_unsup_datasets[0],
                                            &second_datas, &second_meas,
                                            &second_n_meas, &second_n_datas);
+  measurers_need_derivatives = (NeedsDerivatives(mentor_measurers)
+                                || NeedsDerivatives(student_measurers_all));
 
 
   // Shuffling of examples
@@ -349,16 +365,19 @@ void CommunicatingSaePairTrainer::trainMentoring(DataSet *sup_train_data, Measur
     // - for each example, train -
     for(int t = 0; t < n_train; t++)    {
 
-      // - Set derivatives to zero -
-      if(communication_type==0) {
-        ClearDerivatives(second_csae->sup_unsup_comA_machine);
-      }
-      else if(communication_type==1)    {
-        ClearDerivatives(second_csae->sup_unsup_comB_machine);
-      }
-      else      {
-        ClearDerivatives(first_csae->mentor_communicator);        // WASTED COMPUTATIONS! We won't bprop to all these.
-        ClearDerivatives(second_csae->sup_unsup_comC_machine);
+      // - Set derivatives to zero, once per minibatch -
+      if(IsMinibatchStart(t))   {
+        if(communication_type==0) {
+          ClearDerivatives(second_csae->sup_unsup_comA_machine);
+        }
+        else if(communication_type==1)    {
+          ClearDerivatives(second_csae->sup_unsup_comB_machine);
+        }
+        else      {
+          ClearDerivatives(first_csae->mentor_communicator);        // only the coders we bprop to
+          ClearDerivatives(second_csae->sup_unsup_comC_machine);
+        }
+        n_accumulated_examples = 0;
       }
 
       // - Set the example -
@@ -397,7 +416,8 @@ void CommunicatingSaePairTrainer::trainMentoring(DataSet *sup_train_data, Measur
 
       // *** Profile the 4 gradients at each layer ***
       if(profile_local_gradients)
-        ProfileLocalGradMeasureExample(second_csae, sup_train_data, gradient_profiling_measurers, student_criterions, saved_grads);
+        ProfileLocalGradMeasureExample(second_csae, sup_train_data, gradient_profiling_measurers,
+                                       ((ConcatCriterion*)student_concat_criterion)->criterion_betas, saved_grads);
 
       // BACKPROP only communication layers
       // We don't have the inputs for this machine... Should build them.
@@ -413,22 +433,28 @@ void CommunicatingSaePairTrainer::trainMentoring(DataSet *sup_train_data, Measur
         second_csae->sup_unsup_comC_machine->backward(sup_train_data->inputs, student_concat_criterion->beta);
       }
 
+      n_accumulated_examples++;
+
       // the measurers on the training set
       for(int i = 0; i < first_n_meas[0]; i++)
         first_meas[0][i]->measureExample();
       for(int i = 0; i < second_n_meas[0]; i++)
         second_meas[0][i]->measureExample();
 
-      // - Update -
-      if(communication_type==0) {
-        UpdateMachine(second_csae->sup_unsup_comA_machine, current_learning_rate);
-      }
-      else if(communication_type==1)    {
-        UpdateMachine(second_csae->sup_unsup_comB_machine, current_learning_rate);
-      }
-      else      {
-        UpdateMachine(first_csae->mentor_communicator, current_learning_rate);
-        UpdateMachine(second_csae->sup_unsup_comC_machine, current_learning_rate);
+      // - Update, with the gradient averaged over the minibatch -
+      if(IsMinibatchEnd(t, n_train))    {
+        real batch_learning_rate = current_learning_rate / (real)n_accumulated_examples;
+        PrepareUpdate(n_accumulated_examples);
+        if(communication_type==0) {
+          UpdateMachine(second_csae->sup_unsup_comA_machine, batch_learning_rate);
+        }
+        else if(communication_type==1)    {
+          UpdateMachine(second_csae->sup_unsup_comB_machine, batch_learning_rate);
+        }
+        else      {
+          UpdateMachine(first_csae->mentor_communicator, batch_learning_rate);
+          UpdateMachine(second_csae->sup_unsup_comC_machine, batch_learning_rate);
+        }
       }
 
       // Note que peut-etre faudrait foutre
@@ -443,6 +469,8 @@ void CommunicatingSaePairTrainer::trainMentoring(DataSet *sup_train_data, Measur
       err += student_concat_criterion->outputs->frames[0][0];
     }
 
+    FlushWeightDecay();
+
     // trainset measurers
     for(int i = 0; i < first_n_meas[0]; i++)  {
       first_meas[0][i]->measureIteration();
@@ -543,30 +571,43 @@ void CommunicatingSaePairTrainer::train(DataSet *data, MeasurerList *measurers)
 }
 
 
-void CommunicatingSaePairTrainer::ClearDerivatives(GradientMachine *gm)
+void CommunicatingSaePairTrainer::PrepareUpdate(int n_examples)
 {
-  Parameters *der_params = gm->der_params;
-  if(der_params)    {
-    for(int i=0; i<der_params->n_data; i++)        {
-      memset(der_params->data[i], 0, sizeof(real)*der_params->size[i]);
-    }
-  }
+  first_csae->AddSmoothingGradient((real)n_examples);
+  second_csae->AddSmoothingGradient((real)n_examples);
+  StochasticGradientPlus::PrepareUpdate(n_examples);
 }
 
-void CommunicatingSaePairTrainer::UpdateMachine(GradientMachine *gm, real current_learning_rate)
+void CommunicatingSaePairTrainer::PrepareOptimizer(GradientMachine *gm)
 {
-  // - update -
-  Parameters *params = gm->params;
-  Parameters *der_params = gm->der_params;
-  if(params)        {
-    for(int i=0; i<params->n_data; i++) {
-      real *ptr_params = params->data[i];
-      real *ptr_der_params = der_params->data[i];
-      for(int j=0; j<params->size[i]; j++)      {
-        ptr_params[j] -= current_learning_rate * ptr_der_params[j];
-      }
-    }
-  }
+  optimizer->AddBlock(first_csae->arena->params, first_csae->arena->n_reals);
+  optimizer->AddBlock(second_csae->arena->params, second_csae->arena->n_reals);
+  StochasticGradientPlus::PrepareOptimizer(gm);
+}
+
+// Each array belongs to the coders of one of the two csaes.
+void CommunicatingSaePairTrainer::FindTouchedArrays(Parameters *der_params, bool *touched)
+{
+  first_csae->FindTouchedArrays(der_params, touched);
+  second_csae->FindTouchedArrays(der_params, touched);
+}
+
+void CommunicatingSaePairTrainer::SetTouched(Parameters *der_params, bool touched)
+{
+  first_csae->SetTouched(der_params, touched);
+  second_csae->SetTouched(der_params, touched);
+}
+
+void CommunicatingSaePairTrainer::ApplyWeightDecay(GradientMachine *gm, real learning_rate)
+{
+  first_csae->ApplyWeightDecay(gm->params, learning_rate);
+  second_csae->ApplyWeightDecay(gm->params, learning_rate);
+}
+
+void CommunicatingSaePairTrainer::FlushWeightDecay()
+{
+  first_csae->FlushWeightDecay();
+  second_csae->FlushWeightDecay();
 }
 
 
@@ -578,24 +619,22 @@ void CommunicatingSaePairTrainer::ProfileLocalGradInit(CommunicatingStackedAutoe
 {
   std::string dir = expdir + "/grad";
 
+  profiled_betas = (Sequence**)allocator->alloc(sizeof(Sequence*)*5*csae->n_hidden_layers);
+
   std::stringstream ss;
   for(int i=0; i<csae->n_hidden_layers; i++)     {
+    for(int j=0; j<4; j++)
+      profiled_betas[5*i+j] = new(allocator) Sequence(0, csae->encoders[i]->n_outputs);
+    profiled_betas[5*i+4] = new(allocator) Sequence(0, csae->listeners[i]->n_inputs);
 
     // supervised
     ss.str("");
     ss.clear();
     ss << expdir << "grad/stats_grad_sup_" << i << ".txt";
     DiskXFile *file_grad_sup = new(allocator) DiskXFile(ss.str().c_str(),"w");
-    StatisticsMeasurer *measurer_grad_sup = NULL;
-    if(i<csae->n_hidden_layers-1)       {
-      measurer_grad_sup = new(allocator) StatisticsMeasurer(NULL,
-                                                            file_grad_sup,
-                                                            csae->encoders[i+1]->beta);
-    }   else    {
-      measurer_grad_sup = new(allocator) StatisticsMeasurer(NULL,
-                                                            file_grad_sup,
-                                                            csae->outputer->beta);
-    }
+    StatisticsMeasurer *measurer_grad_sup = new(allocator) StatisticsMeasurer(NULL,
+                                                                              file_grad_sup,
+                                                                              profiled_betas[5*i]);
     measurers->addNode(measurer_grad_sup);
 
     // unsupervised
@@ -605,7 +644,7 @@ void CommunicatingSaePairTrainer::ProfileLocalGradInit(CommunicatingStackedAutoe
     DiskXFile *file_grad_unsup = new(allocator) DiskXFile(ss.str().c_str(),"w");
     StatisticsMeasurer *measurer_grad_unsup = new(allocator) StatisticsMeasurer(NULL,
                                                                                 file_grad_unsup,
-                                                                                csae->decoders[i]->beta);
+                                                                                profiled_betas[5*i+1]);
     measurers->addNode(measurer_grad_unsup);
 
     // social agreement
@@ -615,7 +654,7 @@ void CommunicatingSaePairTrainer::ProfileLocalGradInit(CommunicatingStackedAutoe
     DiskXFile *file_grad_social_agree = new(allocator) DiskXFile(ss.str().c_str(),"w");
     StatisticsMeasurer *measurer_grad_social_agree = new(allocator) StatisticsMeasurer(NULL,
                                                                                        file_grad_social_agree,
-                                                                                       csae->speakers[i]->beta);
+                                                                                       profiled_betas[5*i+2]);
     measurers->addNode(measurer_grad_social_agree);
 
     // social usefulness
@@ -625,7 +664,7 @@ void CommunicatingSaePairTrainer::ProfileLocalGradInit(CommunicatingStackedAutoe
     DiskXFile *file_grad_social_useful = new(allocator) DiskXFile(ss.str().c_str(),"w");
     StatisticsMeasurer *measurer_grad_social_useful = new(allocator) StatisticsMeasurer(NULL,
                                                                                         file_grad_social_useful,
-                                                                                        csae->speakerlisteners[i]->beta);
+                                                                                        profiled_betas[5*i+3]);
     measurers->addNode(measurer_grad_social_useful);
 
     // for measuring angles, we need to hold the different gradients
@@ -650,70 +689,51 @@ void CommunicatingSaePairTrainer::ProfileLocalGradInit(CommunicatingStackedAutoe
 
 }
 
-// Ok inefficient... we backprop so many times.
+// Each cost's part of the betas is backpropagated alone, betas only (see
+// Coder::BackwardBeta): the derivatives are left to the training backward
+// that follows.
 void CommunicatingSaePairTrainer::ProfileLocalGradMeasureExample(CommunicatingStackedAutoencoder *csae,
                                                                  DataSet *data,
                                                                  MeasurerList *measurers,
-                                                                 Criterion **criterions,
+                                                                 Sequence **criterion_betas,
                                                                  real*** saved_grad)
 {
-  // supervised gradient
-  csae->backward(data->inputs, criterions[0]->beta);
+  // supervised gradient, from the top down
+  int top = csae->n_hidden_layers-1;
+  csae->outputer->BackwardBeta(criterion_betas[0], profiled_betas[5*top]);
+  for(int i=top-1; i>=0; i--)
+    csae->encoders[i+1]->BackwardBeta(profiled_betas[5*(i+1)], profiled_betas[5*i]);
 
   int c_offset, m_offset;
-  Sequence *inputs;
   for(int i=0; i<csae->n_hidden_layers; i++)     {
     m_offset = 5*i;
+    c_offset = 1+csae->n_hidden_layers+2*i;
 
     // supervised gradient
     measurers->nodes[m_offset]->measureExample();
-    if(i<csae->n_hidden_layers-1)       {
-      csae->encoders[i+1]->beta->copyTo(saved_grad[i][0]);
-    }   else    {
-      csae->outputer->beta->copyTo(saved_grad[i][0]);
-    }
-    measurers->nodes[m_offset]->measureExample();
+    profiled_betas[m_offset]->copyTo(saved_grad[i][0]);
 
-    // reconstruction gradient
-    if(csae->is_noisy)  {
-      // in this case we profile the gradient wrt the noisy encoder, not the
-      // encoder.
-      inputs = csae->noisy_encoders[i]->outputs;
-    }
-    else
-      inputs = csae->encoders[i]->outputs;
-    csae->decoders[i]->backward(inputs, criterions[1+i]->beta);
+    // reconstruction gradient (with respect to the noisy encoder in the noisy
+    // case)
+    csae->decoders[i]->BackwardBeta(criterion_betas[1+i], profiled_betas[m_offset+1]);
     measurers->nodes[m_offset+1]->measureExample();
-    csae->decoders[i]->beta->copyTo(saved_grad[i][1]);
-    //ClearDerivatives(csae->decoders[i]);
-    //ClearDerivatives(csae->encoders[i]);        // in case of tied weights
-                                                // because backward will write
-                                                // in der_params it doesn't
-                                                // own!
-
-    inputs = csae->encoders[i]->outputs;        // same for next two machines
-    c_offset = 1+csae->n_hidden_layers+2*i;
+    profiled_betas[m_offset+1]->copyTo(saved_grad[i][1]);
 
     // speech agreement
-    csae->speakers[i]->backward(inputs, criterions[c_offset]->beta);
+    csae->speakers[i]->BackwardBeta(criterion_betas[c_offset], profiled_betas[m_offset+2]);
     measurers->nodes[m_offset+2]->measureExample();
-    csae->speakers[i]->beta->copyTo(saved_grad[i][2]);
-    //ClearDerivatives(csae->speakers[i]);
+    profiled_betas[m_offset+2]->copyTo(saved_grad[i][2]);
 
-    // speech usefullness
-    csae->speakerlisteners[i]->backward(inputs, criterions[c_offset+1]->beta);
+    // speech usefullness, through the listener then the speaker
+    Coder *speaker = (csae->is_noisy ? csae->noisy_speakers[i] : csae->speakers[i]);
+    csae->listeners[i]->BackwardBeta(criterion_betas[c_offset+1], profiled_betas[m_offset+4]);
+    speaker->BackwardBeta(profiled_betas[m_offset+4], profiled_betas[m_offset+3]);
     measurers->nodes[m_offset+3]->measureExample();
-    csae->speakerlisteners[i]->beta->copyTo(saved_grad[i][3]);
-    //ClearDerivatives(csae->speakerlisteners[i]);
-    //ClearDerivatives(csae->speakers[i]);        // in case of tied weights
-                                                // because backward will write
-                                                // in der_params it doesn't
-                                                // own!
+    profiled_betas[m_offset+3]->copyTo(saved_grad[i][3]);
+
     // angles
     measurers->nodes[m_offset+4]->measureExample();
   }
-  warning("MUST CLEAR THE RIGHT MACHINE IN PROFILING!");
-  ClearDerivatives(csae->sup_unsup_comC_machine);
 }
 
 void CommunicatingSaePairTrainer::ProfileLocalGradMeasureIteration(CommunicatingStackedAutoencoder *csae, MeasurerList *measurers)
@@ -746,7 +766,12 @@ void CommunicatingSaePairTrainer::ProfileLocalGradClean(CommunicatingStackedAuto
     allocator->free(saved_grad[i][3]);
 
     allocator->free(saved_grad[i]);
+
+    for(int j=0; j<5; j++)
+      allocator->free(profiled_betas[5*i+j]);
   }
+  allocator->free(profiled_betas);
+  profiled_betas = NULL;
 }
 
 CommunicatingSaePairTrainer::~CommunicatingSaePairTrainer()
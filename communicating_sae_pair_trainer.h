@@ -41,6 +41,10 @@ class CommunicatingSaePairTrainer : public StochasticGradientPlus
     std::string expdir;
     int communication_type;
     bool profile_local_gradients;
+    // The parts of the beta of each layer due to each cost, 5 per layer: the
+    // supervised, reconstruction, agreement and usefulness ones, and the beta
+    // of the listener in the usefulness one.
+    Sequence **profiled_betas;
 
     // Must be set prior to calling a training function
     CommunicatingStackedAutoencoder *first_csae;
@@ -85,19 +89,21 @@ class CommunicatingSaePairTrainer : public StochasticGradientPlus
                                 int n_communication_layers, real the_unsup_criterions_weight,
                                 real the_communication_weight);
 
-    // This is not the right place for this function. It should go in
-    // GradientMachine of course.
-    virtual void ClearDerivatives(GradientMachine *gm);
-
-    virtual void UpdateMachine(GradientMachine *gm, real current_learning_rate);
+    virtual void PrepareUpdate(int n_examples);
+    virtual void PrepareOptimizer(GradientMachine *gm);
+    virtual void FindTouchedArrays(Parameters *der_params, bool *touched);
+    virtual void SetTouched(Parameters *der_params, bool touched);
+    virtual void ApplyWeightDecay(GradientMachine *gm, real learning_rate);
+    virtual void FlushWeightDecay();
 
     // *** For profiling the local gradients ***
     // Allocates the measurers
     void ProfileLocalGradInit(CommunicatingStackedAutoencoder *csae, MeasurerList *measurers,
                               real ***saved_grads);
-    // Watch out: 3*hidden_layers measurers, and 1+3*hidden_layers criterions
+    // Watch out: 3*hidden_layers measurers, and the betas of the
+    // 1+3*hidden_layers criterions (see ConcatCriterion::criterion_betas)
     void ProfileLocalGradMeasureExample(CommunicatingStackedAutoencoder *csae, DataSet *data,
-                                        MeasurerList *measurers, Criterion **criterions,
+                                        MeasurerList *measurers, Sequence **criterion_betas,
                                         real ***saved_grad);
     // - -
     void ProfileLocalGradMeasureIteration(CommunicatingStackedAutoencoder *csae, MeasurerList *measurers);
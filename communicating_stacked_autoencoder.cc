@@ -13,6 +13,7 @@
 // limitations under the License.
 //
 #include "communicating_stacked_autoencoder.h"
+#include "parameter_arena.h"
 
 //#include "Linear.h"
 //#include "Tanh.h"
@@ -35,10 +36,11 @@ CommunicatingStackedAutoencoder::CommunicatingStackedAutoencoder(std::string nam
                                                                  bool first_layer_smoothed_,
                                                                  int *n_speech_units_,
                                                                  int communication_type_,
-                                                                 int n_communication_layers_)
+                                                                 int n_communication_layers_,
+                                                                 CommunicatingStackedAutoencoder *params_owner_)
     : StackedAutoencoder( name_, nonlinearity_, tied_weights_, reparametrize_tied_, n_inputs_,
                           n_hidden_layers_, n_hidden_units_per_layer_, n_outputs_,
-                          is_noisy_, first_layer_smoothed_)
+                          is_noisy_, first_layer_smoothed_, params_owner_)
 {
   if (reparametrize_tied_)
     warning("Tied weight reparametrization not handled for communicating part!");
@@ -60,12 +62,12 @@ CommunicatingStackedAutoencoder::CommunicatingStackedAutoencoder(std::string nam
   hidden_handles = (Identity**) allocator->alloc(sizeof(Identity*)*n_hidden_layers);
   speaker_handles = (Identity**) allocator->alloc(sizeof(Identity*)*n_hidden_layers);
   for(int i=0; i<n_hidden_layers; i++)  {
-    hidden_handles[i] = new(allocator) Identity(encoders[i]->n_outputs);
+    hidden_handles[i] = new(allocator) Identity(encoders[i]->n_outputs, true);
   }
 
   if (communication_type > 0)
     for (int i=0; i<n_communication_layers; i++)
-      speaker_handles[i] = new(allocator) Identity(speakers[i]->n_outputs);
+      speaker_handles[i] = new(allocator) Identity(speakers[i]->n_outputs, true);
 
   // The machine constructs
   sup_unsup_comA_machine = NULL;
@@ -86,20 +88,27 @@ CommunicatingStackedAutoencoder::CommunicatingStackedAutoencoder(std::string nam
   //BuildSupUnsupCsupCunsupMachine();
   //BuildMentor();
 
+  // Again, with the communication coders.
+  PackParameters();
 }
 
 void CommunicatingStackedAutoencoder::BuildCommunicationCoders()
 {
+  // The coders of the communicating machine we are a replica of, if any.
+  CommunicatingStackedAutoencoder *owner = (CommunicatingStackedAutoencoder*)params_owner;
+
   // speakers
   speakers = (Coder**) allocator->alloc(sizeof(Coder*)*(n_communication_layers));
   for(int i=0; i<n_communication_layers; i++)    {
     if (communication_type == 2)
       speakers[i] = new(allocator)Coder(encoders[i]->n_outputs, n_speech_units[i],
-                                        false, NULL, false, false, nonlinearity);
+                                        false, NULL, false, false, nonlinearity,
+                                        false, (owner ? owner->speakers[i] : NULL));
     else if (communication_type == 1)
       // This only works for two layers with the same number of hidden units.
       speakers[i] = new(allocator)Coder(encoders[i]->n_outputs, encoders[i]->n_outputs,
-                                        false, NULL, false, false, nonlinearity);
+                                        false, NULL, false, false, nonlinearity,
+                                        false, (owner ? owner->speakers[i] : NULL));
     else
       speakers[i] = NULL;
 
@@ -130,10 +139,12 @@ void CommunicatingStackedAutoencoder::BuildCommunicationCoders()
     for(int i=0; i<n_communication_layers; i++)    {
       if(tied_weights)      {
         listeners[i] = new(allocator)Coder(n_speech_units[i], encoders[i]->n_outputs,
-                                           true, speakers[i], true, false, nonlinearity);
+                                           true, speakers[i], true, false, nonlinearity,
+                                           false, (owner ? owner->listeners[i] : NULL));
       }   else    {
         listeners[i] = new(allocator)Coder(n_speech_units[i], encoders[i]->n_outputs,
-                                           false, NULL, false, false, nonlinearity);
+                                           false, NULL, false, false, nonlinearity,
+                                           false, (owner ? owner->listeners[i] : NULL));
       }
     }
   }
@@ -348,6 +359,99 @@ void CommunicatingStackedAutoencoder::setDestructionOptions(real destruct_prob,
   warning("CommunicatingStackedAutoencoder::setDestructionOptions - fixme");
 }
 
+void CommunicatingStackedAutoencoder::AddArenaLayers(ParameterArena *new_arena)
+{
+  StackedAutoencoder::AddArenaLayers(new_arena);
+
+  if(communication_type == 0)
+    return;
+  for(int i=0; i<n_communication_layers; i++)   {
+    AddCoderLayer(new_arena, speakers[i]);
+    if(noisy_speakers)
+      AddCoderLayer(new_arena, noisy_speakers[i]);
+    if(listeners)
+      AddCoderLayer(new_arena, listeners[i]);
+  }
+}
+
+void CommunicatingStackedAutoencoder::RemapParameters(ParameterArena *new_arena)
+{
+  StackedAutoencoder::RemapParameters(new_arena);
+
+  ConnectedMachine *machines[5] = { sup_unsup_comA_machine, sup_unsup_comB_machine,
+                                    sup_unsup_comC_machine, mentor, mentor_communicator };
+  for(int i=0; i<5; i++)        {
+    if(machines[i]) {
+      new_arena->Remap(machines[i]->params);
+      new_arena->Remap(machines[i]->der_params);
+    }
+  }
+
+  if(communication_type == 0)
+    return;
+  for(int i=0; i<n_communication_layers; i++)   {
+    Coder *coders[3] = { speakers[i], (noisy_speakers ? noisy_speakers[i] : NULL),
+                         (listeners ? listeners[i] : NULL) };
+    for(int j=0; j<3; j++)      {
+      if(coders[j])     {
+        new_arena->Remap(coders[j]->params);
+        new_arena->Remap(coders[j]->der_params);
+      }
+    }
+    if(speakerlisteners)        {
+      new_arena->Remap(speakerlisteners[i]->params);
+      new_arena->Remap(speakerlisteners[i]->der_params);
+    }
+  }
+}
+
+StackedAutoencoder *CommunicatingStackedAutoencoder::NewExecutionContext()
+{
+  CommunicatingStackedAutoencoder *context =
+      new(allocator) CommunicatingStackedAutoencoder(name, nonlinearity, tied_weights,
+                                                     reparametrize_tied,
+                                                     n_units_per_layer[0],
+                                                     n_hidden_layers,
+                                                     &n_units_per_layer[1],
+                                                     n_units_per_layer[n_hidden_layers+1],
+                                                     is_noisy, first_layer_smoothed,
+                                                     n_speech_units, communication_type,
+                                                     n_communication_layers, this);
+  context->CopySettings(this);
+  return context;
+}
+
+StackedAutoencoder *CommunicatingStackedAutoencoder::NewCopy()
+{
+  CommunicatingStackedAutoencoder *copy =
+      new(allocator) CommunicatingStackedAutoencoder(name, nonlinearity, tied_weights,
+                                                     reparametrize_tied,
+                                                     n_units_per_layer[0],
+                                                     n_hidden_layers,
+                                                     &n_units_per_layer[1],
+                                                     n_units_per_layer[n_hidden_layers+1],
+                                                     is_noisy, first_layer_smoothed,
+                                                     n_speech_units, communication_type,
+                                                     n_communication_layers);
+  copy->CopySettings(this);
+  return copy;
+}
+
+void CommunicatingStackedAutoencoder::CopySettings(StackedAutoencoder *from)
+{
+  StackedAutoencoder::CopySettings(from);
+
+  CommunicatingStackedAutoencoder *csae_from = (CommunicatingStackedAutoencoder*)from;
+  for(int i=0; i<n_communication_layers; i++)   {
+    if(speakers[i])
+      speakers[i]->CopySettings(csae_from->speakers[i]);
+    if(noisy_speakers && noisy_speakers[i])
+      noisy_speakers[i]->CopySettings(csae_from->noisy_speakers[i]);
+    if(listeners)
+      listeners[i]->CopySettings(csae_from->listeners[i]);
+  }
+}
+
 void CommunicatingStackedAutoencoder::loadXFile(XFile *file)
 {
   if (communication_type==0)
@@ -363,6 +467,7 @@ void CommunicatingStackedAutoencoder::loadXFile(XFile *file)
 
 void CommunicatingStackedAutoencoder::saveXFile(XFile *file)
 {
+  FlushWeightDecay();
   if (communication_type==0)
     sup_unsup_comA_machine->saveXFile(file);
   else if (communication_type==1)
@@ -79,7 +79,8 @@ class CommunicatingStackedAutoencoder : public StackedAutoencoder
                                     bool first_layer_smoothed_,
                                     int *n_speech_units_,
                                     int communication_type,
-                                    int n_communication_layers);
+                                    int n_communication_layers,
+                                    CommunicatingStackedAutoencoder *params_owner_=NULL);
 
     // Adds (and connects) a communication machine to machine. Layer determines
     // the layer at which the communication takes place.
@@ -102,6 +103,13 @@ class CommunicatingStackedAutoencoder : public StackedAutoencoder
     virtual void setL2WeightDecay(real weight_decay);
     virtual void setDestructionOptions(real destruct_prob, real destruct_value);
 
+    virtual void AddArenaLayers(ParameterArena *new_arena);
+    virtual void RemapParameters(ParameterArena *new_arena);
+
+    virtual StackedAutoencoder *NewExecutionContext();
+    virtual StackedAutoencoder *NewCopy();
+    virtual void CopySettings(StackedAutoencoder *from);
+
     virtual void loadXFile(XFile *file);
     virtual void saveXFile(XFile *file);
 
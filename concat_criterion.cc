@@ -37,7 +37,18 @@ ConcatCriterion::ConcatCriterion(int n_inputs_,
             n_inputs, sum_inputs);
   }
 
-  single_criterion_input = new(allocator) Sequence();
+  criterion_inputs = (Sequence**)allocator->alloc(sizeof(Sequence*)*n_criterions);
+  criterion_betas = (Sequence**)allocator->alloc(sizeof(Sequence*)*n_criterions);
+  for(int i=0; i<n_criterions; i++)     {
+    criterion_inputs[i] = new(allocator) Sequence();
+    criterion_betas[i] = new(allocator) Sequence();
+  }
+  sliced_inputs_frames = NULL;
+  sliced_inputs_first_frame = NULL;
+  n_sliced_inputs_frames = 0;
+  sliced_beta_frames = NULL;
+  sliced_beta_first_frame = NULL;
+  n_sliced_beta_frames = 0;
 
   if(!criterion_weights)  {
     criterion_weights = (real *)allocator->alloc(sizeof(real)*n_criterions);
@@ -45,6 +56,7 @@ ConcatCriterion::ConcatCriterion(int n_inputs_,
       criterion_weights[i] = 1.;
   }
 
+  addIOption("n threads", &n_threads, 1, "number of threads running the criterions (needs OpenMP)");
 }
 
 // The underlying criterions already have their data.
@@ -65,24 +77,51 @@ void ConcatCriterion::reset()
     criterions[i]->reset();
 }
 
-// The output contains the weighted sum of the .
-void ConcatCriterion::forward(Sequence *inputs)
+void ConcatCriterion::SliceFrames(Sequence *whole, Sequence **slices)
 {
-  // Start by forwarding each individual criterion
   int offset=0;
-  single_criterion_input->resize(inputs->n_frames,false);       // do not allocate memory!
-
   for(int i = 0; i < n_criterions; i++) {
-    // set the input
-    single_criterion_input->frame_size = criterions[i]->n_inputs;
-    for(int f=0; f<inputs->n_frames; f++)       {
-      single_criterion_input->frames[f] = inputs->frames[f] + offset;
-    }
-
-    // forward it
-    criterions[i]->forward(single_criterion_input);
+    slices[i]->resize(whole->n_frames,false);       // do not allocate memory!
+    slices[i]->frame_size = criterions[i]->n_inputs;
+    for(int f=0; f<whole->n_frames; f++)
+      slices[i]->frames[f] = whole->frames[f] + offset;
     offset+=criterions[i]->n_inputs;
   }
+}
+
+void ConcatCriterion::SliceInputs(Sequence *inputs)
+{
+  if(inputs->frames != sliced_inputs_frames || inputs->n_frames != n_sliced_inputs_frames
+     || inputs->frames[0] != sliced_inputs_first_frame)   {
+    SliceFrames(inputs, criterion_inputs);
+    sliced_inputs_frames = inputs->frames;
+    sliced_inputs_first_frame = inputs->frames[0];
+    n_sliced_inputs_frames = inputs->n_frames;
+  }
+}
+
+void ConcatCriterion::SliceBeta()
+{
+  if(beta->frames != sliced_beta_frames || beta->n_frames != n_sliced_beta_frames
+     || beta->frames[0] != sliced_beta_first_frame)   {
+    SliceFrames(beta, criterion_betas);
+    sliced_beta_frames = beta->frames;
+    sliced_beta_first_frame = beta->frames[0];
+    n_sliced_beta_frames = beta->n_frames;
+  }
+}
+
+// The output contains the weighted sum of the .
+void ConcatCriterion::forward(Sequence *inputs)
+{
+  SliceInputs(inputs);
+
+  // Start by forwarding each individual criterion
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(n_threads) if(n_threads > 1)
+#endif
+  for(int i = 0; i < n_criterions; i++)
+    criterions[i]->forward(criterion_inputs[i]);
 
   // Now do this machine's actual forward
   int n_frames_ = criterions[0]->outputs->n_frames;
@@ -98,43 +137,29 @@ void ConcatCriterion::forward(Sequence *inputs)
   }
 }
 
+// Each frame of a criterion's beta is weighted while it is still in cache.
+// The alphas of criterions are NULL.
 void ConcatCriterion::backward(Sequence *inputs, Sequence *alpha)
 {
-  // Start by backwarding each individual criterion
-  int offset=0;
-  single_criterion_input->resize(inputs->n_frames,false);
+  SliceInputs(inputs);
+  beta->resize(inputs->n_frames);
+  SliceBeta();
 
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(n_threads) if(n_threads > 1)
+#endif
   for(int i=0; i<n_criterions; i++) {
-    // set the input
-    single_criterion_input->frame_size = criterions[i]->n_inputs;
-    for(int f=0; f<inputs->n_frames; f++)       {
-      single_criterion_input->frames[f] = inputs->frames[f] + offset;
-    }
-    offset+=criterions[i]->n_inputs;
-
-    // backward it - alphas is NULL OR should be...
-    criterions[i]->backward(single_criterion_input, alpha);
-  }
-
-  // Now do this machine's actual backward
-  int n_frames_ = inputs->n_frames;
-  beta->resize(n_frames_);
-
-  real *beta_;
-  real *single_criterion_beta_;
-  real w_;
-
-  //memcpy(beta->frames[f]+offset, criterions[c]->beta->frames[f], sizeof(real)*criterions[c]->n_inputs);
-  for(int i=0; i<n_frames_; i++)        {
-    offset=0;
-    for(int j=0; j<n_criterions; j++) {
-      beta_ = beta->frames[i] + offset;
-      single_criterion_beta_ = criterions[j]->beta->frames[i];
-      w_ = criterion_weights[j];
-      for(int k=0; k<criterions[j]->n_inputs; k++)    {
-        beta_[k] = w_ * single_criterion_beta_[k];
+    Criterion *criterion = criterions[i];
+    Sequence *inputs_ = criterion_inputs[i];
+    Sequence *beta_ = criterion_betas[i];
+    real w_ = criterion_weights[i];
+    for(int f=0; f<beta_->n_frames; f++)        {
+      real *beta_frame = beta_->frames[f];
+      criterion->frameBackward(f, inputs_->frames[f], beta_frame, criterion->outputs->frames[f], NULL);
+      if(w_ != 1.)      {
+        for(int k=0; k<beta_->frame_size; k++)
+          beta_frame[k] *= w_;
       }
-      offset += criterions[j]->n_inputs;
     }
   }
 }
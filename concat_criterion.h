@@ -27,20 +27,45 @@ namespace Torch {
 // It is different from MultiCriterion in that the criterions each have
 // different inputs.
 //
+// Nothing is copied: the inputs of the criterions are slices of the inputs
+// of this machine, and the criterions are backpropagated frame by frame
+// (through frameBackward) into the slices of its beta, each frame being
+// weighted as soon as it is written. The weighted betas are thus in
+// #criterion_betas#, and the criterions' own betas are left alone. The slices
+// are only rebuilt when the frames change.
+//
+// With the "n threads" option (and OpenMP), the criterions are run in
+// parallel. They must then be independent.
+//
 class ConcatCriterion : public Criterion
 {
   public:
 
-    Sequence *single_criterion_input;
-
     int n_criterions;
     Criterion **criterions;
     real *criterion_weights;    // the weights applied to the criterion *inside this machine*,
+    int n_threads;
+
+    // The slices, and the frames they were built for.
+    Sequence **criterion_inputs;
+    Sequence **criterion_betas;
+    real **sliced_inputs_frames;
+    real *sliced_inputs_first_frame;
+    int n_sliced_inputs_frames;
+    real **sliced_beta_frames;
+    real *sliced_beta_first_frame;
+    int n_sliced_beta_frames;
 
     //
     ConcatCriterion(int n_inputs_, int n_criterions_, Criterion** criterions_,
                     real *criterion_weights_=NULL);
 
+    // Points the slices to the frames of #whole#.
+    virtual void SliceFrames(Sequence *whole, Sequence **slices);
+    // Rebuild the slices if the frames changed.
+    virtual void SliceInputs(Sequence *inputs);
+    virtual void SliceBeta();
+
     //-----
     virtual void forward(Sequence *inputs);
     virtual void backward(Sequence *inputs, Sequence *alpha);
@@ -0,0 +1,36 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "derivatives_reader.h"
+
+namespace Torch {
+
+bool NeedsDerivatives(Measurer *measurer)
+{
+  DerivativesReader *reader = dynamic_cast<DerivativesReader *>(measurer);
+  return (reader && reader->NeedsDerivatives());
+}
+
+bool NeedsDerivatives(MeasurerList *measurers)
+{
+  if(!measurers)
+    return false;
+  for(int i=0; i<measurers->n_nodes; i++)   {
+    if(NeedsDerivatives(measurers->nodes[i]))
+      return true;
+  }
+  return false;
+}
+
+}
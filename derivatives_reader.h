@@ -0,0 +1,40 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_DERIVATIVES_READER_H_
+#define TORCH_DERIVATIVES_READER_H_
+
+#include "Measurer.h"
+#include "Trainer.h"         // for MeasurerList!
+
+namespace Torch {
+
+// Implemented by the measurers that read the der_params of a machine, so
+// that the trainers keep them after the updates instead of clearing them in
+// the same sweep (see StochasticGradientPlus::FuseClearWithUpdate).
+class DerivativesReader
+{
+  public:
+    virtual bool NeedsDerivatives() = 0;
+    virtual ~DerivativesReader() {}
+};
+
+// True if #measurer# is a DerivativesReader that needs the der_params.
+bool NeedsDerivatives(Measurer *measurer);
+// True if one of the #measurers# does. #measurers# may be NULL.
+bool NeedsDerivatives(MeasurerList *measurers);
+
+}
+
+#endif // TORCH_DERIVATIVES_READER_H_
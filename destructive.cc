@@ -13,29 +13,65 @@
 // limitations under the License.
 //
 #include "destructive.h"
-#include "Random.h"
+#include "simd.h"
 
 namespace Torch {
 
 Destructive::Destructive(int n_units) : GradientMachine(n_units, n_units)
 {
-  destroyed = (bool*)malloc(sizeof(bool)*n_units);
+  n_words = (n_units + 63) / 64;
+  n_allocated_frames = 1;
+  destroyed = (uint64_t*)malloc(sizeof(uint64_t)*n_words);
 
   addROption("Destruction probability", &destruct_prob, 0.2, "Probability of setting a unit to the destruction value.");
   addROption("Destruction value", &destruct_value, 0.0, "The value destroyed units are attributed.");
 }
 
-void Destructive::frameForward(int t, real *f_inputs, real *f_outputs)
+void Destructive::DrawMask(int t)
 {
-  for(int i = 0; i < n_inputs; i++)     {
-    if(Random::uniform()<destruct_prob) {
-      destroyed[i]=true;
-      f_outputs[i]=destruct_value;
-    }   else    {
-      destroyed[i]=false;
-      f_outputs[i]=f_inputs[i];
+  if(t >= n_allocated_frames)   {
+    n_allocated_frames = t+1;
+    destroyed = (uint64_t*)realloc(destroyed, sizeof(uint64_t)*n_words*n_allocated_frames);
+  }
+
+  // Each 64 bit draw gives two 32 bit uniforms.
+  uint64_t threshold;
+  if(destruct_prob >= 1.)
+    threshold = 0x100000000ULL;
+  else if(destruct_prob <= 0.)
+    threshold = 0;
+  else
+    threshold = (uint64_t)(destruct_prob * 4294967296.0);
+
+  uint64_t *mask = FrameMask(t);
+  for(int w = 0; w < n_words; w++)      {
+    uint64_t bits = 0;
+    for(int b = 0; b < 64; b += 2)      {
+      uint64_t r = rng.Next();
+      bits |= (uint64_t)((r & 0xFFFFFFFFULL) < threshold) << b;
+      bits |= (uint64_t)((r >> 32) < threshold) << (b+1);
     }
+    mask[w] = bits;
   }
+  // Keep the bits past the last unit cleared.
+  if(n_inputs % 64)
+    mask[n_words-1] &= (1ULL << (n_inputs % 64)) - 1;
+}
+
+void Destructive::frameForward(int t, real *f_inputs, real *f_outputs)
+{
+  DrawMask(t);
+
+  uint64_t *mask = FrameMask(t);
+  simd_real value = SimdSplat(destruct_value);
+  int n_simd = SimdFloor(n_inputs);
+  int i = 0;
+  for(; i < n_simd; i += kSimdWidth)     {
+    simd_mask m = SimdMaskFromBits(mask[i >> 6] >> (i & 63));
+    SimdStore(f_outputs+i, SimdSelect(m, value, SimdLoad(f_inputs+i)));
+  }
+  for(; i < n_inputs; i++)
+    f_outputs[i] = (IsDestroyed(t, i) ? destruct_value : f_inputs[i]);
 }
 
 void Destructive::frameBackward(int t, real *f_inputs, real *beta_, real *f_outputs, real *alpha_)
@@ -43,13 +79,16 @@ void Destructive::frameBackward(int t, real *f_inputs, real *beta_, real *f_outp
   if(partial_backprop)
     return;
 
-  for(int i = 0; i < n_outputs; i++)    {
-    if(destroyed[i])    {
-      beta_[i]=0.0;
-    }   else    {
-      beta_[i]=alpha_[i];
-    }
+  uint64_t *mask = FrameMask(t);
+  simd_real zero = SimdSplat(0.);
+  int n_simd = SimdFloor(n_outputs);
+  int i = 0;
+  for(; i < n_simd; i += kSimdWidth)     {
+    simd_mask m = SimdMaskFromBits(mask[i >> 6] >> (i & 63));
+    SimdStore(beta_+i, SimdSelect(m, zero, SimdLoad(alpha_+i)));
   }
+  for(; i < n_outputs; i++)
+    beta_[i] = (IsDestroyed(t, i) ? 0.0 : alpha_[i]);
 }
 
 Destructive::~Destructive()
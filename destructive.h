@@ -16,20 +16,45 @@
 #define TORCH_DESTRUCTIVE_H_
 
 #include "GradientMachine.h"
+#include "fast_random.h"
 
 namespace Torch {
 
+// Sets each input to #destruct_value# with probability #destruct_prob#.
+//
+// The corruption masks are bitsets, one per frame, drawn in bulk from the
+// machine's own FastRandom stream and applied with SIMD selects.
 class Destructive : public GradientMachine
 {
   public:
 
-    bool *destroyed;
+    // One bitset of n_words per frame: bit i is set if unit i is destroyed.
+    // Grown as needed in frameForward.
+    uint64_t *destroyed;
+    int n_words;
+    int n_allocated_frames;
 
     real destruct_prob;
     real destruct_value;
 
+    FastRandom rng;
+
     Destructive(int n_units);
 
+    // The mask of frame t.
+    inline uint64_t *FrameMask(int t)
+    {
+      return destroyed + t*n_words;
+    }
+
+    inline bool IsDestroyed(int t, int i)
+    {
+      return (FrameMask(t)[i >> 6] >> (i & 63)) & 1;
+    }
+
+    // Draws the mask of frame t.
+    virtual void DrawMask(int t);
+
     //-----
 
     virtual void frameForward(int t, real *f_inputs, real *f_outputs);
@@ -43,6 +43,11 @@ void FakeDataMeasurer::measureEnd()
   wrapped_measurer->measureEnd();
 }
 
+bool FakeDataMeasurer::NeedsDerivatives()
+{
+  return Torch::NeedsDerivatives(wrapped_measurer);
+}
+
 FakeDataMeasurer::~FakeDataMeasurer()
 {
 }
@@ -16,6 +16,7 @@
 #define TORCH_FAKE_DATA_MEASURER_H_
 
 #include "Measurer.h"
+#include "derivatives_reader.h"
 
 namespace Torch {
 
@@ -25,7 +26,7 @@ namespace Torch {
 // fprop!
 // WARNING! Setting this classe's instance option will not set the option of
 // the wrapped measurer...
-class FakeDataMeasurer : public Measurer
+class FakeDataMeasurer : public Measurer, public DerivativesReader
 {
   public:
     Measurer *wrapped_measurer;
@@ -37,6 +38,8 @@ class FakeDataMeasurer : public Measurer
     virtual void measureIteration();
     virtual void measureEnd();
     virtual void reset();
+    // The ones of the wrapped measurer.
+    virtual bool NeedsDerivatives();
 
     virtual ~FakeDataMeasurer();
 };
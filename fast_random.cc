@@ -0,0 +1,44 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "fast_random.h"
+#include "Random.h"
+
+namespace Torch {
+
+FastRandom::FastRandom()
+{
+  SeedFromRandom();
+}
+
+void FastRandom::Seed(uint64_t seed)
+{
+  for(int i=0; i<4; i++)  {
+    seed += 0x9E3779B97F4A7C15ULL;
+    uint64_t z = seed;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    state[i] = z ^ (z >> 31);
+  }
+}
+
+void FastRandom::SeedFromRandom()
+{
+  // Random::random() gives 32 bits.
+  uint64_t high = (uint64_t)(Random::random() & 0xFFFFFFFFUL);
+  uint64_t low = (uint64_t)(Random::random() & 0xFFFFFFFFUL);
+  Seed((high << 32) | low);
+}
+
+}
@@ -0,0 +1,70 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_FAST_RANDOM_H_
+#define TORCH_FAST_RANDOM_H_
+
+#include "general.h"
+#include <stdint.h>
+
+namespace Torch {
+
+// A small xoshiro256** generator. Unlike the static Random, each instance is
+// its own stream, so machines that own one can run in different threads.
+//
+// By default the state is seeded from Random, so a run stays reproducible from
+// the seed given to Random::manualSeed before the machines are built.
+class FastRandom
+{
+  public:
+
+    uint64_t state[4];
+
+    FastRandom();
+
+    // Seeds the state from a single value, through splitmix64.
+    void Seed(uint64_t seed);
+    // Seeds the state with a value drawn from Random.
+    void SeedFromRandom();
+
+    inline uint64_t Next()
+    {
+      uint64_t result = Rotl(state[1] * 5, 7) * 9;
+      uint64_t t = state[1] << 17;
+      state[2] ^= state[0];
+      state[3] ^= state[1];
+      state[1] ^= state[2];
+      state[0] ^= state[3];
+      state[2] ^= t;
+      state[3] = Rotl(state[3], 45);
+      return result;
+    }
+
+    // Uniform in [0,1).
+    inline real Uniform()
+    {
+      return (real)((Next() >> 11) * (1.0/9007199254740992.0));
+    }
+
+  private:
+
+    static inline uint64_t Rotl(uint64_t x, int k)
+    {
+      return (x << k) | (x >> (64 - k));
+    }
+};
+
+}
+
+#endif  // TORCH_FAST_RANDOM_H_
@@ -0,0 +1,120 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "gradient_statistics.h"
+
+namespace Torch {
+
+GradientStatistics::GradientStatistics()
+{
+  n_parameters = 0;
+  n_samples = 0;
+  n_examples = 0;
+  means = NULL;
+  m2s = NULL;
+}
+
+void GradientStatistics::Reset()
+{
+  n_samples = 0;
+  n_examples = 0;
+  if(n_parameters)      {
+    memset(means, 0, sizeof(real)*n_parameters);
+    memset(m2s, 0, sizeof(real)*n_parameters);
+  }
+}
+
+void GradientStatistics::Add(Parameters *der_params, real scale, int n_examples_)
+{
+  int n = 0;
+  for(int i=0; i<der_params->n_data; i++)
+    n += der_params->size[i];
+
+  if(!means)    {
+    n_parameters = n;
+    means = (real*)allocator->alloc(sizeof(real)*n_parameters);
+    m2s = (real*)allocator->alloc(sizeof(real)*n_parameters);
+    Reset();
+  }
+  if(n != n_parameters)
+    error("GradientStatistics - %d parameters instead of %d.", n, n_parameters);
+
+  n_samples++;
+  n_examples += n_examples_;
+  real inv_n_samples = 1./(real)n_samples;
+
+  int index = 0;
+  for(int i=0; i<der_params->n_data; i++)       {
+    real *x = der_params->data[i];
+    for(int j=0; j<der_params->size[i]; j++)    {
+      real delta = scale*x[j] - means[index];
+      means[index] += delta * inv_n_samples;
+      m2s[index] += delta * (scale*x[j] - means[index]);
+      index++;
+    }
+  }
+}
+
+// The pairwise update of Chan et al.
+void GradientStatistics::Merge(GradientStatistics *other)
+{
+  if(!other->n_samples)
+    return;
+  if(!n_samples)        {
+    if(!means)  {
+      n_parameters = other->n_parameters;
+      means = (real*)allocator->alloc(sizeof(real)*n_parameters);
+      m2s = (real*)allocator->alloc(sizeof(real)*n_parameters);
+    }
+    memcpy(means, other->means, sizeof(real)*n_parameters);
+    memcpy(m2s, other->m2s, sizeof(real)*n_parameters);
+    n_samples = other->n_samples;
+    n_examples = other->n_examples;
+    return;
+  }
+  if(other->n_parameters != n_parameters)
+    error("GradientStatistics - can't merge statistics of different parameters.");
+
+  real n = (real)(n_samples + other->n_samples);
+  real other_fraction = (real)other->n_samples / n;
+  real cross = (real)n_samples * (real)other->n_samples / n;
+  for(int i=0; i<n_parameters; i++)     {
+    real delta = other->means[i] - means[i];
+    means[i] += delta * other_fraction;
+    m2s[i] += other->m2s[i] + delta * delta * cross;
+  }
+  n_samples += other->n_samples;
+  n_examples += other->n_examples;
+}
+
+real GradientStatistics::MaxVariance()
+{
+  if(!n_samples)
+    return 0.;
+
+  real max_m2 = 0.;
+  for(int i=0; i<n_parameters; i++)     {
+    if(max_m2 < m2s[i])
+      max_m2 = m2s[i];
+  }
+
+  // The variance of the samples, times the number of examples per sample.
+  return max_m2 / (real)n_samples * (real)n_examples / (real)n_samples;
+}
+
+GradientStatistics::~GradientStatistics()
+{
+}
+
+}
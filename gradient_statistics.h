@@ -0,0 +1,63 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_GRADIENT_STATISTICS_H_
+#define TORCH_GRADIENT_STATISTICS_H_
+
+#include "Object.h"
+#include "Parameters.h"
+
+namespace Torch {
+
+// Running mean and variance of each parameter's gradient (Welford's
+// algorithm), over the arrays of a Parameters. Used by
+// StackedAutoencoderTrainer to weigh its criterions.
+//
+// A sample can be the mean gradient of several examples, e.g. of a
+// minibatch. The variance of one example's gradient is then estimated from
+// the variance of the means, which is 1/n times smaller for means of n
+// examples.
+//
+// The buffers are allocated by the first Add and kept by Reset, so the
+// statistics can be gathered again at each epoch.
+class GradientStatistics : public Object
+{
+  public:
+    int n_parameters;
+    int n_samples;
+    int n_examples;       // summed over the samples
+    real *means;
+    real *m2s;            // sums of the squared deviations from the mean
+
+    GradientStatistics();
+
+    // Forgets the samples.
+    virtual void Reset();
+    // Adds #scale# times the gradient in #der_params# as one sample, the
+    // mean gradient of #n_examples_# examples.
+    virtual void Add(Parameters *der_params, real scale=1., int n_examples_=1);
+    // Adds the samples of #other#, gathered on the same parameters (e.g. by
+    // another thread), as if they had been added here.
+    virtual void Merge(GradientStatistics *other);
+
+    // The variance of one example's gradient for the largest parameter, or
+    // 0 without samples.
+    virtual real MaxVariance();
+
+    virtual ~GradientStatistics();
+};
+
+}
+
+#endif  // TORCH_GRADIENT_STATISTICS_H_
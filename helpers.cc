@@ -19,6 +19,9 @@
 #include <fstream>
 #include "Linear.h"
 #include "MemoryXFile.h"
+#include "activations.h"
+#include "softmax_class_measurer.h"
+#include "softmax_class_nll_measurer.h"
 
 namespace Torch {
 
@@ -36,7 +39,8 @@ DiskXFile* InitResultsFile(Allocator* allocator,std::string expdir, std::string
 void AddClassificationMeasurers(Allocator* allocator, std::string expdir,
                                 MeasurerList *measurers, Machine *machine,
                                 DataSet *train, DataSet *valid, DataSet *test,
-                                ClassFormat *class_format, bool disk_results)
+                                ClassFormat *class_format, bool disk_results,
+                                SoftmaxNLLCriterion *criterion)
 {
   std::stringstream ss;
   XFile* tfile_mentor_train_nll;
@@ -60,8 +64,14 @@ void AddClassificationMeasurers(Allocator* allocator, std::string expdir,
     tfile_mentor_train_nll = file_mentor_train_nll;
   }
 
-  ClassNLLMeasurer *measurer_mentor_train_nll = new(allocator) ClassNLLMeasurer(machine->outputs, train,
-                                                                             class_format, tfile_mentor_train_nll);
+  ClassNLLMeasurer *measurer_mentor_train_nll;
+  if(criterion)
+    measurer_mentor_train_nll = new(allocator) SoftmaxClassNLLMeasurer(machine->outputs, train,
+                                                                       class_format, tfile_mentor_train_nll,
+                                                                       criterion);
+  else
+    measurer_mentor_train_nll = new(allocator) ClassNLLMeasurer(machine->outputs, train,
+                                                                class_format, tfile_mentor_train_nll);
   measurers->addNode(measurer_mentor_train_nll);
   ss.str("");
   ss.clear();
@@ -76,8 +86,14 @@ void AddClassificationMeasurers(Allocator* allocator, std::string expdir,
     tfile_mentor_train_class = file_mentor_train_class;
   }
 
-  ClassMeasurer *measurer_mentor_train_class = new(allocator) ClassMeasurer(machine->outputs, train,
-                                                                         class_format, tfile_mentor_train_class);
+  ClassMeasurer *measurer_mentor_train_class;
+  if(criterion)
+    measurer_mentor_train_class = new(allocator) SoftmaxClassMeasurer(machine->outputs, train,
+                                                                      class_format, tfile_mentor_train_class,
+                                                                      criterion);
+  else
+    measurer_mentor_train_class = new(allocator) ClassMeasurer(machine->outputs, train,
+                                                               class_format, tfile_mentor_train_class);
   measurers->addNode(measurer_mentor_train_class);
   // valid
   ss.str("");
@@ -151,9 +167,12 @@ void AddClassificationMeasurers(Allocator* allocator, std::string expdir,
 }
 
 
-Criterion* NewUnsupCriterion(Allocator* allocator, std::string recons_cost, int size)
+Criterion* NewUnsupCriterion(Allocator* allocator, std::string recons_cost, int size,
+                             Coder *coder)
 {
   if(recons_cost=="xentropy")   {
+    if(coder && BaseNonlinearity(coder->nonlinearity)=="sigmoid")
+      return new(allocator) SigmoidCrossEntropyCriterion(coder);
     return new(allocator) CrossEntropyCriterion(size);
   }     else if(recons_cost=="mse")     {
     return new(allocator) MSECriterion(size);
@@ -202,11 +221,15 @@ void BuildSaeUnsupDataSetsCriteriaMeasurers(Allocator *allocator,
       unsup_datasets[i] = new(allocator) DynamicDataSet(supervised_train_data, (Sequence*)NULL, sae->encoders[i-1]->outputs);
 
     // Criterion
-    unsup_criterions[i] = NewUnsupCriterion(allocator, recons_cost, sae->decoders[i]->n_outputs);
+    unsup_criterions[i] = NewUnsupCriterion(allocator, recons_cost, sae->decoders[i]->n_outputs,
+                                            sae->decoders[i]);
     unsup_criterions[i]->setBOption("average frame size", criterion_avg_frame_size);
     unsup_criterions[i]->setDataSet(unsup_datasets[i]);
 
     // Measurer
+    if(!unsup_measurers)
+      continue;
+
     ss.str("");
     ss.clear();
 
@@ -410,6 +433,8 @@ void SaveCSAE(std::string expdir, std::string type, int n_layers, int n_inputs,
   model_.taggedWrite(&csae->n_communication_layers, sizeof(int), 1, "n_communication_layers");
 
 
+  // The approximate activations come after the original three, so older
+  // models still load.
   int nonlinearity_integer;
   if(nonlinearity=="tanh")    {
     nonlinearity_integer = 0;
@@ -417,6 +442,14 @@ void SaveCSAE(std::string expdir, std::string type, int n_layers, int n_inputs,
     nonlinearity_integer = 1;
   }     else if (nonlinearity=="nonlinear")     {
     nonlinearity_integer = 2;
+  }     else if (nonlinearity=="tanh_fast")     {
+    nonlinearity_integer = 3;
+  }     else if (nonlinearity=="sigmoid_fast")     {
+    nonlinearity_integer = 4;
+  }     else if (nonlinearity=="tanh_table")     {
+    nonlinearity_integer = 5;
+  }     else if (nonlinearity=="sigmoid_table")     {
+    nonlinearity_integer = 6;
   }     else    {
     nonlinearity_integer = -1;
     error("SaveCSAE - Unrecognized nonlinearity!");
@@ -481,6 +514,14 @@ CommunicatingStackedAutoencoder* LoadCSAE(Allocator* allocator, std::string file
     nonlinearity = "sigmoid";
   }     else if (nonlinearity_integer==2)     {
     nonlinearity = "nonlinear";
+  }     else if (nonlinearity_integer==3)     {
+    nonlinearity = "tanh_fast";
+  }     else if (nonlinearity_integer==4)     {
+    nonlinearity = "sigmoid_fast";
+  }     else if (nonlinearity_integer==5)     {
+    nonlinearity = "tanh_table";
+  }     else if (nonlinearity_integer==6)     {
+    nonlinearity = "sigmoid_table";
   }     else    {
     nonlinearity = "";
     error("LoadCSAE - Unrecognized nonlinearity!");
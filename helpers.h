@@ -31,6 +31,8 @@
 #include "stacked_autoencoder.h"
 #include "communicating_stacked_autoencoder.h"
 #include "cross_entropy_criterion.h"
+#include "sigmoid_cross_entropy_criterion.h"
+#include "softmax_nll_criterion.h"
 #include "cross_entropy_measurer.h"
 #include "communicating_sae_pair_trainer.h"
 #include "binner.h"
@@ -42,15 +44,22 @@ namespace Torch {
 DiskXFile* InitResultsFile(Allocator* allocator,std::string expdir, std::string type);
 
 
+// If the supervised #criterion# is given, the training set measurers read
+// its cache.
 void AddClassificationMeasurers(Allocator* allocator, std::string expdir,
                                 MeasurerList *measurers, Machine *machine,
                                 DataSet *train, DataSet *valid, DataSet *test,
-                                ClassFormat *class_format, bool disk_results);
+                                ClassFormat *class_format, bool disk_results,
+                                SoftmaxNLLCriterion *criterion=NULL);
 
-Criterion* NewUnsupCriterion(Allocator* allocator, std::string recons_cost, int size);
+// If the reconstruction is done by a sigmoid #coder#, the cross entropy is
+// fused with its sigmoid (see SigmoidCrossEntropyCriterion).
+Criterion* NewUnsupCriterion(Allocator* allocator, std::string recons_cost, int size,
+                             Coder *coder=NULL);
 Measurer* NewUnsupMeasurer(Allocator* allocator, std::string recons_cost,
                            Sequence *inputs_, DataSet *data_, XFile *file_);
 
+// #unsup_measurers# may be NULL, e.g. for the replicas of a threaded trainer.
 void BuildSaeUnsupDataSetsCriteriaMeasurers(Allocator *allocator,
                                             std::string expdir,
                                             StackedAutoencoder *sae,
@@ -16,9 +16,37 @@
 
 namespace Torch {
 
-Identity::Identity(int n_units) : GradientMachine(n_units, n_units)
+Identity::Identity(int n_units, bool alias_) : GradientMachine(n_units, n_units)
 {
   // should free outputs and beta if present...
+  alias = alias_;
+}
+
+void Identity::forward(Sequence *inputs)
+{
+  if(!alias)    {
+    GradientMachine::forward(inputs);
+    return;
+  }
+
+  outputs->resize(inputs->n_frames, false);     // do not allocate memory!
+  for(int t = 0; t < inputs->n_frames; t++)
+    outputs->frames[t] = inputs->frames[t];
+}
+
+void Identity::backward(Sequence *inputs, Sequence *alpha)
+{
+  if(!alias)    {
+    GradientMachine::backward(inputs, alpha);
+    return;
+  }
+
+  if(partial_backprop)
+    return;
+
+  beta->resize(alpha->n_frames, false);
+  for(int t = 0; t < alpha->n_frames; t++)
+    beta->frames[t] = alpha->frames[t];
 }
 
 void Identity::frameForward(int t, real *f_inputs, real *f_outputs)
@@ -19,11 +19,19 @@
 
 namespace Torch {
 
+// An Identity used as a handle in a ConnectedMachine (see
+// StackedAutoencoder::input_handle_machine) can alias instead of copying:
+// the frames of its outputs are then those of its inputs, and the frames of
+// its beta those of its alpha. The machines connected on it read the memory
+// of its inputs, and ConnectedMachine accumulates its beta into the upstream
+// alphas straight from the memory of its alpha, which stays put for the whole
+// backward.
 class Identity : public GradientMachine
 {
   public:
+    bool alias;
 
-    Identity(int n_units);
+    Identity(int n_units, bool alias_=false);
 
     //-----
     // I thought about just copying the sequence (not a deep copy) in forward
@@ -31,6 +39,9 @@ class Identity : public GradientMachine
     // ConnectedMachine has already copied outputs, so we can't modify it. In
     // Backward, the problem is that we are given a temporary alpha. So I
     // simply do a copy.
+    // The aliasing mode keeps the Sequences and only points their frames.
+    virtual void forward(Sequence *inputs);
+    virtual void backward(Sequence *inputs, Sequence *alpha);
     virtual void frameForward(int t, real *f_inputs, real *f_outputs);
     virtual void frameBackward(int t, real *f_inputs, real *beta_, real *f_outputs, real *alpha_);
 
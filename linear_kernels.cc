@@ -0,0 +1,391 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "linear_kernels.h"
+
+namespace Torch {
+
+// Length of the weight row segments. A segment of each frame is kept in cache
+// while all the rows go by: n_frames*kTileSize reals.
+static const int kTileSize = 512;
+
+static inline int MinInt(int a, int b)
+{
+  return (a < b) ? a : b;
+}
+
+template <int activation>
+static void LinearForwardFramesT(real *weights, real *bias, int n_inputs, int n_outputs,
+                                 real **inputs, real **outputs, int n_frames)
+{
+  for(int f=0; f<n_frames; f++) {
+    real *outputs_ = outputs[f];
+    for(int o=0; o<n_outputs; o++)
+      outputs_[o] = (bias ? bias[o] : 0.);
+  }
+
+  for(int i0=0; i0<n_inputs; i0+=kTileSize)  {
+    int len = MinInt(kTileSize, n_inputs-i0);
+    real *weights_ = weights + i0;
+    // The activation is applied as each output gets its last contribution.
+    bool last_tile = (i0+len == n_inputs);
+
+    for(int o=0; o<n_outputs; o++)  {
+      // Four frames at a time share the loads of the weight segment.
+      int f=0;
+      for(; f+4<=n_frames; f+=4)  {
+        real *x0 = inputs[f]+i0;
+        real *x1 = inputs[f+1]+i0;
+        real *x2 = inputs[f+2]+i0;
+        real *x3 = inputs[f+3]+i0;
+        real s0 = 0., s1 = 0., s2 = 0., s3 = 0.;
+        for(int i=0; i<len; i++)  {
+          real w = weights_[i];
+          s0 += w * x0[i];
+          s1 += w * x1[i];
+          s2 += w * x2[i];
+          s3 += w * x3[i];
+        }
+        if(last_tile) {
+          outputs[f][o] = Activate(activation, outputs[f][o] + s0);
+          outputs[f+1][o] = Activate(activation, outputs[f+1][o] + s1);
+          outputs[f+2][o] = Activate(activation, outputs[f+2][o] + s2);
+          outputs[f+3][o] = Activate(activation, outputs[f+3][o] + s3);
+        } else  {
+          outputs[f][o] += s0;
+          outputs[f+1][o] += s1;
+          outputs[f+2][o] += s2;
+          outputs[f+3][o] += s3;
+        }
+      }
+      for(; f<n_frames; f++)  {
+        real *x_ = inputs[f]+i0;
+        real s = 0.;
+        for(int i=0; i<len; i++)
+          s += weights_[i] * x_[i];
+        if(last_tile)
+          outputs[f][o] = Activate(activation, outputs[f][o] + s);
+        else
+          outputs[f][o] += s;
+      }
+      weights_ += n_inputs;
+    }
+  }
+}
+
+void LinearForwardFrames(real *weights, real *bias, int n_inputs, int n_outputs,
+                         real **inputs, real **outputs, int n_frames, int activation)
+{
+  TORCH_SWITCH_ACTIVATION(activation, LinearForwardFramesT,
+                          (weights, bias, n_inputs, n_outputs, inputs, outputs, n_frames))
+}
+
+// The alpha with respect to the pre-activation of output o of frame f.
+template <int activation>
+static inline real PreActivationAlpha(real **alphas, real **outputs, int f, int o)
+{
+  if(activation == kActivationNone)
+    return alphas[f][o];
+  else
+    return alphas[f][o] * ActivationDerivative(activation, outputs[f][o]);
+}
+
+template <int activation>
+static void LinearBackwardFramesT(real *weights, real *der_weights, real *der_bias,
+                                  int n_inputs, int n_outputs, real **inputs,
+                                  real **outputs, real **alphas, real **betas,
+                                  int n_frames)
+{
+  if(betas) {
+    for(int f=0; f<n_frames; f++)
+      memset(betas[f], 0, sizeof(real)*n_inputs);
+  }
+
+  for(int o=0; o<n_outputs; o++)  {
+    real sum = 0.;
+    for(int f=0; f<n_frames; f++)
+      sum += PreActivationAlpha<activation>(alphas, outputs, f, o);
+    der_bias[o] += sum;
+  }
+
+  for(int i0=0; i0<n_inputs; i0+=kTileSize)  {
+    int len = MinInt(kTileSize, n_inputs-i0);
+    real *weights_ = weights + i0;
+    real *der_weights_ = der_weights + i0;
+
+    for(int o=0; o<n_outputs; o++)  {
+      for(int f=0; f<n_frames; f++)  {
+        real z = PreActivationAlpha<activation>(alphas, outputs, f, o);
+        real *x_ = inputs[f]+i0;
+        for(int i=0; i<len; i++)
+          der_weights_[i] += z * x_[i];
+        if(betas) {
+          real *beta_ = betas[f]+i0;
+          for(int i=0; i<len; i++)
+            beta_[i] += z * weights_[i];
+        }
+      }
+      weights_ += n_inputs;
+      der_weights_ += n_inputs;
+    }
+  }
+}
+
+void LinearBackwardFrames(real *weights, real *der_weights, real *der_bias,
+                          int n_inputs, int n_outputs,
+                          real **inputs, real **alphas, real **betas, int n_frames,
+                          real **outputs, int activation)
+{
+  TORCH_SWITCH_ACTIVATION(activation, LinearBackwardFramesT,
+                          (weights, der_weights, der_bias, n_inputs, n_outputs,
+                           inputs, outputs, alphas, betas, n_frames))
+}
+
+template <int activation>
+static void LinearSparseForwardFramesT(real *weights, real *bias, int n_inputs, int n_outputs,
+                                       int **indices, real **values, int *n_nonzeros,
+                                       real **outputs, int n_frames)
+{
+  for(int f=0; f<n_frames; f++) {
+    int *indices_ = indices[f];
+    real *values_ = values[f];
+    int n_nonzeros_ = n_nonzeros[f];
+    real *outputs_ = outputs[f];
+    real *weights_ = weights;
+    for(int o=0; o<n_outputs; o++)  {
+      real s = (bias ? bias[o] : 0.);
+      for(int k=0; k<n_nonzeros_; k++)
+        s += weights_[indices_[k]] * values_[k];
+      outputs_[o] = Activate(activation, s);
+      weights_ += n_inputs;
+    }
+  }
+}
+
+void LinearSparseForwardFrames(real *weights, real *bias, int n_inputs, int n_outputs,
+                               int **indices, real **values, int *n_nonzeros,
+                               real **outputs, int n_frames, int activation)
+{
+  TORCH_SWITCH_ACTIVATION(activation, LinearSparseForwardFramesT,
+                          (weights, bias, n_inputs, n_outputs, indices, values, n_nonzeros,
+                           outputs, n_frames))
+}
+
+template <int activation>
+static void LinearSparseBackwardFramesT(real *weights, real *der_weights, real *der_bias,
+                                        int n_inputs, int n_outputs,
+                                        int **indices, real **values, int *n_nonzeros,
+                                        real **outputs, real **alphas, real **betas,
+                                        int n_frames)
+{
+  for(int f=0; f<n_frames; f++) {
+    int *indices_ = indices[f];
+    real *values_ = values[f];
+    int n_nonzeros_ = n_nonzeros[f];
+    real *beta_ = (betas ? betas[f] : NULL);
+    if(beta_)
+      memset(beta_, 0, sizeof(real)*n_inputs);
+
+    real *weights_ = weights;
+    real *der_weights_ = der_weights;
+    for(int o=0; o<n_outputs; o++)  {
+      real z = PreActivationAlpha<activation>(alphas, outputs, f, o);
+      der_bias[o] += z;
+      // Only the columns of the nonzero inputs get a derivative...
+      for(int k=0; k<n_nonzeros_; k++)
+        der_weights_[indices_[k]] += z * values_[k];
+      // ... but all the inputs get a beta.
+      if(beta_) {
+        for(int i=0; i<n_inputs; i++)
+          beta_[i] += z * weights_[i];
+      }
+      weights_ += n_inputs;
+      der_weights_ += n_inputs;
+    }
+  }
+}
+
+void LinearSparseBackwardFrames(real *weights, real *der_weights, real *der_bias,
+                                int n_inputs, int n_outputs,
+                                int **indices, real **values, int *n_nonzeros,
+                                real **alphas, real **betas, int n_frames,
+                                real **outputs, int activation)
+{
+  TORCH_SWITCH_ACTIVATION(activation, LinearSparseBackwardFramesT,
+                          (weights, der_weights, der_bias, n_inputs, n_outputs,
+                           indices, values, n_nonzeros, outputs, alphas, betas, n_frames))
+}
+
+int GatherNonzeros(real *inputs, int n_inputs, int *indices, real *values)
+{
+  int n_nonzeros = 0;
+  for(int i=0; i<n_inputs; i++)  {
+    if(inputs[i] != 0.) {
+      indices[n_nonzeros] = i;
+      values[n_nonzeros] = inputs[i];
+      n_nonzeros++;
+    }
+  }
+  return n_nonzeros;
+}
+
+// Number of simd_real accumulators kept in registers by the transposed
+// forward: a block of kOutputBlock*kSimdWidth outputs.
+static const int kOutputBlock = 4;
+
+template <int activation>
+static void TransposedLinearForwardFramesT(real *weights, real *bias, real multiplier,
+                                           int n_inputs, int n_outputs,
+                                           real **inputs, real **outputs, int n_frames)
+{
+  simd_real multiplier_ = SimdSplat(multiplier);
+  int block_size = kOutputBlock*kSimdWidth;
+  int o0 = 0;
+
+  // The output block is accumulated in registers over all the inputs, then
+  // scaled, biased and activated before being stored. The column block of
+  // weights is shared by the frames through the cache.
+  for(; o0+block_size<=n_outputs; o0+=block_size) {
+    for(int f=0; f<n_frames; f++)  {
+      real *x_ = inputs[f];
+      real *weights_ = weights + o0;
+      simd_real acc[kOutputBlock];
+      for(int k=0; k<kOutputBlock; k++)
+        acc[k] = SimdSplat(0.);
+      for(int i=0; i<n_inputs; i++)  {
+        simd_real x = SimdSplat(x_[i]);
+        for(int k=0; k<kOutputBlock; k++)
+          acc[k] += x * SimdLoad(weights_ + k*kSimdWidth);
+        weights_ += n_outputs;
+      }
+      real *outputs_ = outputs[f] + o0;
+      for(int k=0; k<kOutputBlock; k++)  {
+        simd_real out = acc[k] * multiplier_;
+        if(bias)
+          out += SimdLoad(bias + o0 + k*kSimdWidth);
+        if(activation != kActivationNone)
+          out = ActivateSimd(activation, out);
+        SimdStore(outputs_ + k*kSimdWidth, out);
+      }
+    }
+  }
+
+  for(; o0+kSimdWidth<=n_outputs; o0+=kSimdWidth) {
+    for(int f=0; f<n_frames; f++)  {
+      real *x_ = inputs[f];
+      real *weights_ = weights + o0;
+      simd_real acc = SimdSplat(0.);
+      for(int i=0; i<n_inputs; i++)  {
+        acc += SimdSplat(x_[i]) * SimdLoad(weights_);
+        weights_ += n_outputs;
+      }
+      acc *= multiplier_;
+      if(bias)
+        acc += SimdLoad(bias + o0);
+      if(activation != kActivationNone)
+        acc = ActivateSimd(activation, acc);
+      SimdStore(outputs[f] + o0, acc);
+    }
+  }
+
+  for(; o0<n_outputs; o0++) {
+    for(int f=0; f<n_frames; f++)  {
+      real *x_ = inputs[f];
+      real sum = 0.;
+      for(int i=0; i<n_inputs; i++)
+        sum += x_[i] * weights[i*n_outputs+o0];
+      outputs[f][o0] = Activate(activation, multiplier * sum + (bias ? bias[o0] : 0.));
+    }
+  }
+}
+
+void TransposedLinearForwardFrames(real *weights, real *bias, real multiplier,
+                                   int n_inputs, int n_outputs,
+                                   real **inputs, real **outputs, int n_frames,
+                                   int activation)
+{
+  TORCH_SWITCH_ACTIVATION(activation, TransposedLinearForwardFramesT,
+                          (weights, bias, multiplier, n_inputs, n_outputs,
+                           inputs, outputs, n_frames))
+}
+
+template <int activation>
+static void TransposedLinearBackwardFramesT(real *weights, real *der_weights, real *der_bias,
+                                            real multiplier, int n_inputs, int n_outputs,
+                                            real **inputs, real **outputs, real **alphas,
+                                            real **betas, int n_frames)
+{
+  if(betas) {
+    for(int f=0; f<n_frames; f++)
+      memset(betas[f], 0, sizeof(real)*n_inputs);
+  }
+
+  for(int o=0; o<n_outputs; o++)  {
+    real sum = 0.;
+    for(int f=0; f<n_frames; f++)
+      sum += PreActivationAlpha<activation>(alphas, outputs, f, o);
+    der_bias[o] += sum;
+  }
+
+  // One sweep over each weight row segment gives both the beta dot product and
+  // the rank-1 update of der_weights. The alpha segments of all the frames stay
+  // in cache while the rows go by. The activation derivative is applied to
+  // alpha as it is loaded.
+  for(int o0=0; o0<n_outputs; o0+=kTileSize)  {
+    int len = MinInt(kTileSize, n_outputs-o0);
+    int len_simd = SimdFloor(len);
+    real *weights_ = weights + o0;
+    real *der_weights_ = der_weights + o0;
+
+    for(int i=0; i<n_inputs; i++)  {
+      for(int f=0; f<n_frames; f++)  {
+        real *alpha_ = alphas[f]+o0;
+        real *outputs_ = (activation != kActivationNone ? outputs[f]+o0 : NULL);
+        simd_real z = SimdSplat(multiplier * inputs[f][i]);
+        simd_real dot = SimdSplat(0.);
+        int o=0;
+        for(; o<len_simd; o+=kSimdWidth)  {
+          simd_real a = SimdLoad(alpha_+o);
+          if(activation != kActivationNone)
+            a *= ActivationDerivativeSimd(activation, SimdLoad(outputs_+o));
+          dot += SimdLoad(weights_+o) * a;
+          SimdStore(der_weights_+o, SimdLoad(der_weights_+o) + z * a);
+        }
+        real s = SimdSum(dot);
+        real z_ = multiplier * inputs[f][i];
+        for(; o<len; o++)  {
+          real a = PreActivationAlpha<activation>(alphas, outputs, f, o0+o);
+          s += weights_[o] * a;
+          der_weights_[o] += z_ * a;
+        }
+        if(betas)
+          betas[f][i] += multiplier * s;
+      }
+      weights_ += n_outputs;
+      der_weights_ += n_outputs;
+    }
+  }
+}
+
+void TransposedLinearBackwardFrames(real *weights, real *der_weights, real *der_bias,
+                                    real multiplier, int n_inputs, int n_outputs,
+                                    real **inputs, real **alphas, real **betas,
+                                    int n_frames, real **outputs, int activation)
+{
+  TORCH_SWITCH_ACTIVATION(activation, TransposedLinearBackwardFramesT,
+                          (weights, der_weights, der_bias, multiplier, n_inputs, n_outputs,
+                           inputs, outputs, alphas, betas, n_frames))
+}
+
+}
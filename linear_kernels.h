@@ -0,0 +1,92 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_LINEAR_KERNELS_H_
+#define TORCH_LINEAR_KERNELS_H_
+
+#include "general.h"
+#include "activations.h"
+
+namespace Torch {
+
+// Blocked kernels for the linear layers, working on several frames at once.
+//
+// The frames are given as arrays of pointers, as in a Sequence. The loops are
+// tiled so that a tile of the weight matrix is read from memory once for all
+// the frames, instead of once per frame as with frameForward/frameBackward.
+//
+// The transposed kernels are vectorized with simd.h. The backward reads each
+// weight once for both beta and der_weights.
+//
+// Two weight layouts are supported:
+//   - the Linear layout: one row of n_inputs weights per output,
+//   - the transposed layout used by TransposedTiedLinear: one row of
+//     n_outputs weights per input.
+
+// Each kernel can also apply an activation (see activations.h) to its
+// outputs. The backward is then given the activated outputs and the alphas
+// with respect to them, and applies the activation derivative on the fly.
+
+// outputs[f] = activation(bias + W inputs[f]). bias may be NULL.
+void LinearForwardFrames(real *weights, real *bias, int n_inputs, int n_outputs,
+                         real **inputs, real **outputs, int n_frames,
+                         int activation=kActivationNone);
+
+// With z[f] the alphas with respect to the pre-activations:
+// betas[f] = W^T z[f] (skipped if betas is NULL, i.e. partial backprop),
+// der_weights += sum_f z[f] inputs[f]^T, der_bias += sum_f z[f].
+// Computes beta and the weight derivatives in the same sweep over W.
+// outputs is only used with an activation.
+void LinearBackwardFrames(real *weights, real *der_weights, real *der_bias,
+                          int n_inputs, int n_outputs,
+                          real **inputs, real **alphas, real **betas, int n_frames,
+                          real **outputs=NULL, int activation=kActivationNone);
+
+// Sparse versions of the Linear kernels, for inputs that are mostly zeros.
+// The nonzero inputs of frame f are given as n_nonzeros[f] (index, value)
+// pairs, see GatherNonzeros. Forward only reads the weights of the nonzero
+// inputs, and backward only updates their der_weights. betas, if given, are
+// still computed for all the inputs.
+void LinearSparseForwardFrames(real *weights, real *bias, int n_inputs, int n_outputs,
+                               int **indices, real **values, int *n_nonzeros,
+                               real **outputs, int n_frames,
+                               int activation=kActivationNone);
+
+void LinearSparseBackwardFrames(real *weights, real *der_weights, real *der_bias,
+                                int n_inputs, int n_outputs,
+                                int **indices, real **values, int *n_nonzeros,
+                                real **alphas, real **betas, int n_frames,
+                                real **outputs=NULL, int activation=kActivationNone);
+
+// Fills indices and values (n_inputs long at most) with the nonzero inputs
+// and returns their number.
+int GatherNonzeros(real *inputs, int n_inputs, int *indices, real *values);
+
+// outputs[f] = activation(multiplier * W^T inputs[f] + bias), in the
+// transposed layout. bias may be NULL.
+void TransposedLinearForwardFrames(real *weights, real *bias, real multiplier,
+                                   int n_inputs, int n_outputs,
+                                   real **inputs, real **outputs, int n_frames,
+                                   int activation=kActivationNone);
+
+// The backward of TransposedLinearForwardFrames. betas may be NULL.
+void TransposedLinearBackwardFrames(real *weights, real *der_weights, real *der_bias,
+                                    real multiplier, int n_inputs, int n_outputs,
+                                    real **inputs, real **alphas, real **betas,
+                                    int n_frames, real **outputs=NULL,
+                                    int activation=kActivationNone);
+
+}
+
+#endif  // TORCH_LINEAR_KERNELS_H_
@@ -195,9 +195,9 @@ int main(int argc, char **argv)
   //Coder model(flag_n_inputs, flag_n_classes, false, NULL, false, false, "logsoftmax");
   Coder model(flag_n_inputs, flag_n_classes, false, NULL, false, false, "none");
 
-  model.linear_layer->setROption("l1 weight decay", flag_l1_decay);
-  model.linear_layer->setROption("weight decay", flag_l2_decay);
-  model.linear_layer->setROption("bias decay", flag_bias_decay);
+  model.setL1WeightDecay(flag_l1_decay);
+  model.setL2WeightDecay(flag_l2_decay);
+  model.setBiasDecay(flag_bias_decay);
 
   message("Model instanciated.\n");
 
@@ -239,6 +239,7 @@ int main(int argc, char **argv)
 
   // === Train the csae ===
   StochasticGradientPlus trainer(&model, &criterion, NULL);
+  trainer.AddDecayedCoder(&model);
 
   trainer.setROption("end accuracy", flag_accuracy);
   trainer.setROption("learning rate decay", flag_lrate_decay);
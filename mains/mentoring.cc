@@ -61,6 +61,7 @@ communication weights, are fixed during the student's training\n";
 #include "stacked_autoencoder_trainer.h"
 #include "communicating_sae_pair_trainer.h"
 #include "helpers.h"
+#include "activations.h"
 
 
 using namespace Torch;
@@ -143,7 +144,7 @@ int main(int argc, char **argv)
   cmd.addICmdOption("-n_hidden_units", &flag_n_hidden_units, 5, "number of hidden units on each hidden layer", true);
   cmd.addICmdOption("-n_speech", &flag_n_speech, 5, "number of speech units on each communicating layer", true);
   cmd.addBCmdOption("-tied_weights", &flag_tied_weights, false, "wether autoencoder weights are tied", true);
-  cmd.addSCmdOption("-nonlinearity", &flag_nonlinearity, "sigmoid", "type of the nonlinearity (sigmoid, tanh, nonlinear)", true);
+  cmd.addSCmdOption("-nonlinearity", &flag_nonlinearity, "sigmoid", "type of the nonlinearity (sigmoid, tanh, nonlinear). Add _fast or _table to sigmoid or tanh for an approximation", true);
   cmd.addSCmdOption("-recons_cost", &flag_recons_cost, "xentropy", "which cost to use for reconstruction", true);
   cmd.addRCmdOption("-corrupt_prob", &flag_corrupt_prob, 0.0, "probability of corrupting autoencoder inputs", true);
   cmd.addRCmdOption("-corrupt_value", &flag_corrupt_value, 0.0, "value to corrupt autoencoder inputs to", true);
@@ -189,7 +190,8 @@ int main(int argc, char **argv)
   warning("bias decay not implemented yet!");
 
   // check reconstruction cost coherence with transfer function
-  if(flag_recons_cost=="xentropy" && flag_nonlinearity!="nonlinear" && flag_nonlinearity!="sigmoid")      {
+  std::string base_nonlinearity = BaseNonlinearity(str_nonlinearity);
+  if(flag_recons_cost=="xentropy" && base_nonlinearity!="nonlinear" && base_nonlinearity!="sigmoid")      {
     error("With xentropy reconstruction, must use a transfer function with output in [0,1]. (nonlinear for now)");
   }
 
@@ -41,6 +41,7 @@ the supervised cost.\n";
 #include "ClassNLLMeasurer.h"
 #include "Trainer.h"         // for MeasurerList!
 #include "ClassNLLCriterion.h"
+#include "softmax_nll_criterion.h"
 #include "MSECriterion.h"
 #include "ConnectedMachine.h"
 //#include "GradientCheckMeasurer.h"
@@ -50,7 +51,10 @@ the supervised cost.\n";
 #include "stacked_autoencoder.h"
 #include "communicating_stacked_autoencoder.h"
 #include "stacked_autoencoder_trainer.h"
+#include "shared_data_set.h"
+#include "minibatch_data_set.h"
 #include "helpers.h"
+#include "activations.h"
 #include "binner.h"
 
 
@@ -89,6 +93,8 @@ int main(int argc, char **argv)
   bool flag_first_layer_smoothed;
   real flag_l1_smoothing_decay;
   real flag_l2_smoothing_decay;
+  int flag_image_width;
+  int flag_image_height;
 
   // --- Training ---
   int flag_max_iter_lwu;
@@ -96,6 +102,19 @@ int main(int argc, char **argv)
   int flag_max_iter_ac;
   int flag_max_iter_sc;
   real flag_accuracy;
+  int flag_minibatch_size;
+  bool flag_batch_frames;
+  int flag_n_threads;
+  bool flag_sync_threads;
+  bool flag_async_eval;
+  bool flag_parallel_eval;
+  char *flag_optimizer;
+  real flag_momentum;
+  real flag_decay_rate;
+  bool flag_cache_lower_layers;
+  bool flag_cache_frozen_layers;
+  bool flag_half_precision_cache;
+  char *flag_cache_file_prefix;
 
   real flag_lr_lwu;
   real flag_lr_unsup;
@@ -115,6 +134,7 @@ int main(int argc, char **argv)
   real flag_unsup_weight;
   bool flag_unsup_trains_outputer;
   bool flag_eval_criter_weights;
+  bool flag_sample_criter_weights;
   bool flag_criter_avg_framesize;
   bool flag_profile_gradients;
   bool flag_partial_backprop;
@@ -162,7 +182,7 @@ int main(int argc, char **argv)
   cmd.addICmdOption("-n_hidden_units", &flag_n_hidden_units, 5, "number of hidden units on each hidden layer", true);
   cmd.addICmdOption("-n_speech", &flag_n_speech, 5, "number of speech units on each communicating layer", true);
   cmd.addBCmdOption("-tied_weights", &flag_tied_weights, false, "wether autoencoder weights are tied", true);
-  cmd.addSCmdOption("-nonlinearity", &flag_nonlinearity, "sigmoid", "type of the nonlinearity (sigmoid, tanh, nonlinear)", true);
+  cmd.addSCmdOption("-nonlinearity", &flag_nonlinearity, "sigmoid", "type of the nonlinearity (sigmoid, tanh, nonlinear). Add _fast or _table to sigmoid or tanh for an approximation", true);
   cmd.addSCmdOption("-recons_cost", &flag_recons_cost, "xentropy", "which cost to use for reconstruction", true);
   cmd.addRCmdOption("-corrupt_prob", &flag_corrupt_prob, 0.0, "probability of corrupting autoencoder inputs", true);
   cmd.addRCmdOption("-corrupt_value", &flag_corrupt_value, 0.0, "value to corrupt autoencoder inputs to", true);
@@ -172,6 +192,8 @@ int main(int argc, char **argv)
   cmd.addBCmdOption("-first_layer_smoothed", &flag_first_layer_smoothed, false, "if you want to have a smoothing weight decay on the 1st layer.");
   cmd.addRCmdOption("-l1_smoothing_decay", &flag_l1_smoothing_decay, 0.0, "L1 Smoothing weight decay.");
   cmd.addRCmdOption("-l2_smoothing_decay", &flag_l2_smoothing_decay, 0.0, "L2 Smoothing weight decay.");
+  cmd.addICmdOption("-image_width", &flag_image_width, 0, "width of the input images for the smoothing decay (0 for square images)");
+  cmd.addICmdOption("-image_height", &flag_image_height, 0, "height of the input images for the smoothing decay (0 for square images)");
 
   // Training
   cmd.addText("\nTraining options:");
@@ -180,6 +202,19 @@ int main(int argc, char **argv)
   cmd.addICmdOption("-max_iter_ac", &flag_max_iter_ac, 2, "max number of iterations with all the costs (3rd phase)", true);
   cmd.addICmdOption("-max_iter_sc", &flag_max_iter_sc, 2, "max number of iterations with only supervised cost (4th phase)", true);
   cmd.addRCmdOption("-accuracy", &flag_accuracy, 1e-5, "end accuracy", true);
+  cmd.addICmdOption("-minibatch_size", &flag_minibatch_size, 1, "number of examples per parameter update (gradients are averaged)", true);
+  cmd.addBCmdOption("-batch_frames", &flag_batch_frames, false, "without threads, run each minibatch as one example of several frames", true);
+  cmd.addICmdOption("-n_threads", &flag_n_threads, 1, "number of threads training lock-free on parts of the epoch", true);
+  cmd.addBCmdOption("-sync_threads", &flag_sync_threads, false, "with threads, split the minibatches and sum the gradients reproducibly instead", true);
+  cmd.addBCmdOption("-async_eval", &flag_async_eval, false, "with threads, measure each epoch in a thread while the next one trains", true);
+  cmd.addBCmdOption("-parallel_eval", &flag_parallel_eval, false, "with threads, forward the valid and test sets on the threads' execution contexts", true);
+  cmd.addSCmdOption("-optimizer", &flag_optimizer, "sgd", "update rule (sgd, momentum, nesterov, adagrad, rmsprop, adam)", true);
+  cmd.addRCmdOption("-momentum", &flag_momentum, 0.9, "momentum, or first moment decay of adam", true);
+  cmd.addRCmdOption("-decay_rate", &flag_decay_rate, 0.999, "squared gradient decay of rmsprop and adam", true);
+  cmd.addBCmdOption("-cache_lower_layers", &flag_cache_lower_layers, false, "in layerwise pretraining, store the outputs of the layer below once", true);
+  cmd.addBCmdOption("-cache_frozen_layers", &flag_cache_frozen_layers, false, "when training the top layers, store the outputs of the frozen ones once", true);
+  cmd.addBCmdOption("-half_precision_cache", &flag_half_precision_cache, false, "store the outputs of the frozen layers as half floats", true);
+  cmd.addSCmdOption("-cache_file_prefix", &flag_cache_file_prefix, "", "if not empty, map the stored outputs from files with this prefix rather than keeping them in memory", true);
 
   cmd.addRCmdOption("-lr_lwu", &flag_lr_lwu, 1e-3, "learning rate layerwise unsup phase", true);
   cmd.addRCmdOption("-lr_unsup", &flag_lr_unsup, 1e-3, "learning rate unsup phase", true);
@@ -200,6 +235,7 @@ int main(int argc, char **argv)
   cmd.addRCmdOption("-unsup_weight", &flag_unsup_weight, 1.0, "multiplicative weight to give to the unsupervised costs.", true);
   cmd.addBCmdOption("-unsup_trains_outputer", &flag_unsup_trains_outputer, false, "if true, train the outputer during the unsup phase.", true);
   cmd.addBCmdOption("-eval_criter_weights", &flag_eval_criter_weights, false, "if true, weigh the criterions based on hessian-based magic.", true);
+  cmd.addBCmdOption("-sample_criter_weights", &flag_sample_criter_weights, false, "if true, estimate the criterion weights on samples at each epoch rather than online.", true);
   cmd.addBCmdOption("-criter_avg_framesize", &flag_criter_avg_framesize, false, "if true, costs of unsup criterions are divided by number of inputs", true);
   cmd.addBCmdOption("-profile_gradients", &flag_profile_gradients, false, "if true, profile the gradients", true);
   cmd.addBCmdOption("-partial_backprop", &flag_partial_backprop, false, "if true, will not backpropagate gradients to lower layers during unsupervised training", true);
@@ -233,7 +269,8 @@ int main(int argc, char **argv)
   std::string str_recons_cost = flag_recons_cost;
   std::string str_nonlinearity = flag_nonlinearity;
 
-  if(str_recons_cost=="xentropy" && str_nonlinearity!="nonlinear" && str_nonlinearity!="sigmoid")  {
+  std::string base_nonlinearity = BaseNonlinearity(str_nonlinearity);
+  if(str_recons_cost=="xentropy" && base_nonlinearity!="nonlinear" && base_nonlinearity!="sigmoid")  {
     error("With xentropy reconstruction, must use a transfer function with output in [0,1].");
   }
 
@@ -285,6 +322,14 @@ int main(int argc, char **argv)
      << "-uto=" << flag_unsup_trains_outputer
      << "-ecw=" << flag_eval_criter_weights << "-cFs=" << flag_criter_avg_framesize
      << "-ss=" << flag_start_seed << "-ms=" << flag_model_seed;
+  if (flag_minibatch_size > 1)
+    ss << "-mb=" << flag_minibatch_size;
+  if (std::string(flag_optimizer) != "sgd")
+    ss << "-opt=" << flag_optimizer << "-mom=" << flag_momentum << "-dr=" << flag_decay_rate;
+  if (flag_n_threads > 1)
+    ss << "-nt=" << flag_n_threads << "-st=" << flag_sync_threads;
+  if (flag_cache_frozen_layers)
+    ss << "-cfl=" << flag_cache_frozen_layers << "-hpc=" << flag_half_precision_cache;
 
   if (flag_multiple_results_files)
      ss << "/";
@@ -328,6 +373,12 @@ int main(int argc, char **argv)
 
   OneHotClassFormat class_format(&train_data);
 
+  // The DataSet trained on. With -batch_frames, a view of the training set
+  // that gathers the minibatches. The measurers stay on the training set.
+  DataSet *trained_data = &train_data;
+  if(flag_batch_frames && flag_minibatch_size > 1 && flag_n_threads <= 1)
+    trained_data = new(allocator) MinibatchDataSet(&train_data, flag_minibatch_size);
+
 
   // === Create the model ===
   int *units_per_hidden_layer = (int*)malloc(sizeof(int)*(flag_n_layers));
@@ -355,18 +406,21 @@ int main(int argc, char **argv)
   csae.setBiasDecay(flag_bias_decay);
   csae.setDestructionOptions(flag_corrupt_prob, flag_corrupt_value);
   csae.setSmoothingDecay(flag_l1_smoothing_decay, flag_l2_smoothing_decay);
+  if(flag_image_width > 0 && flag_image_height > 0)
+    csae.setSmoothingImageSize(flag_image_width, flag_image_height);
 
   message("Models instanciated.\n");
 
+  // === Criterion ===
+  // Fused with the LogSoftMax of the outputer.
+  SoftmaxNLLCriterion csae_supervised_criterion(&class_format, csae.outputer);
+
   // === Measurers ===
   MeasurerList csae_measurers;
   AddClassificationMeasurers(allocator, expdir, &csae_measurers, &csae,
                              &train_data, &valid_data, &test_data,
-                             &class_format, flag_multiple_results_files);
-
-
-  // === Criterion ===
-  ClassNLLCriterion csae_supervised_criterion(&class_format);
+                             &class_format, flag_multiple_results_files,
+                             &csae_supervised_criterion);
 
   // === Create the unsupervised datasets, criteria and measurer ===
   DataSet **unsup_datasets = (DataSet**) allocator->alloc(sizeof(DataSet*)*csae.n_hidden_layers);
@@ -376,7 +430,7 @@ int main(int argc, char **argv)
   BuildSaeUnsupDataSetsCriteriaMeasurers(allocator,
                                          expdir,
                                          &csae,
-                                         &train_data,
+                                         trained_data,
                                          &csae_supervised_criterion,
                                          flag_recons_cost,
                                          flag_criter_avg_framesize,
@@ -399,6 +453,52 @@ int main(int argc, char **argv)
 
   csae_trainer.setROption("end accuracy", flag_accuracy);
   csae_trainer.setROption("learning rate decay", flag_lrate_decay);
+  csae_trainer.setIOption("minibatch size", flag_minibatch_size);
+  if(trained_data != &train_data)
+    csae_trainer.minibatch_data = (MinibatchDataSet *)trained_data;
+  csae_trainer.optimizer->setIOption("type", OptimizerFromName(flag_optimizer));
+  csae_trainer.optimizer->setROption("momentum", flag_momentum);
+  csae_trainer.optimizer->setROption("decay rate", flag_decay_rate);
+  csae_trainer.setBOption("cache lower layers", flag_cache_lower_layers);
+  csae_trainer.setBOption("cache frozen layers", flag_cache_frozen_layers);
+  csae_trainer.setBOption("half precision cache", flag_half_precision_cache);
+  csae_trainer.setBOption("sample criterion weights", flag_sample_criter_weights);
+  csae_trainer.cache_file_prefix = flag_cache_file_prefix;
+
+  // === Replicas for multithreaded training ===
+  // Each thread trains its own execution context of the csae, which shares
+  // its parameters, on its own view of the training set. With asynchronous
+  // evaluation, they share the parameters of a copy of the csae instead, and
+  // the csae is measured on snapshots. Otherwise, the valid and test sets can
+  // be forwarded on the contexts as well.
+  if(flag_n_threads > 1)  {
+    StackedAutoencoder *trained_csae = &csae;
+    if(flag_async_eval) {
+      trained_csae = csae.NewCopy();
+      csae_trainer.setBOption("asynchronous evaluation", true);
+    }
+    for(int r=0; r<flag_n_threads; r++)   {
+      StackedAutoencoder *replica = trained_csae->NewExecutionContext();
+      SharedDataSet *replica_train_data = new(allocator) SharedDataSet(&train_data);
+      SoftmaxNLLCriterion *replica_criterion = new(allocator) SoftmaxNLLCriterion(&class_format, replica->outputer);
+
+      DataSet **replica_unsup_datasets = (DataSet**) allocator->alloc(sizeof(DataSet*)*replica->n_hidden_layers);
+      Criterion **replica_unsup_criterions = (Criterion**) allocator->alloc(sizeof(Criterion*)*replica->n_hidden_layers);
+      BuildSaeUnsupDataSetsCriteriaMeasurers(allocator, expdir, replica,
+                                             replica_train_data, replica_criterion,
+                                             flag_recons_cost, flag_criter_avg_framesize,
+                                             replica_unsup_datasets, replica_unsup_criterions,
+                                             NULL, false);
+
+      StackedAutoencoderTrainer *replica_trainer = new(allocator) StackedAutoencoderTrainer(replica, replica_criterion, expdir);
+      replica_trainer->unsup_datasets = replica_unsup_datasets;
+      replica_trainer->unsup_criterions = replica_unsup_criterions;
+      csae_trainer.AddReplica(replica_trainer, replica_train_data);
+    }
+    csae_trainer.setIOption("n threads", flag_n_threads);
+    csae_trainer.setBOption("synchronous threads", flag_sync_threads);
+    csae_trainer.setBOption("parallel evaluation", flag_parallel_eval);
+  }
 
   DiskXFile* resultsfile = NULL;
   if(flag_profile_gradients)   {
@@ -467,7 +567,7 @@ int main(int argc, char **argv)
 
     // Train
     if( flag_unsup_trains_outputer )
-      csae_trainer.TrainUnsup(&train_data, &csae_measurers);
+      csae_trainer.TrainUnsup(trained_data, &csae_measurers);
     else
       csae_trainer.TrainUnsupNotOutput();
   }
@@ -490,7 +590,7 @@ int main(int argc, char **argv)
       resultsfile = InitResultsFile(allocator,expdir,"supunsup");
       csae_trainer.resultsfile = resultsfile;
     }
-    csae_trainer.TrainSupUnsup(&train_data, &csae_measurers, flag_unsup_weight);
+    csae_trainer.TrainSupUnsup(trained_data, &csae_measurers, flag_unsup_weight);
   }
 
   if(flag_profile_gradients)
@@ -534,7 +634,7 @@ int main(int argc, char **argv)
       csae_trainer.resultsfile = resultsfile;
     }
 
-    csae_trainer.train(&train_data, &csae_measurers);
+    csae_trainer.train(trained_data, &csae_measurers);
   }
  
 
@@ -0,0 +1,134 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "minibatch_data_set.h"
+
+namespace Torch {
+
+MinibatchDataSet::MinibatchDataSet(DataSet *data_, int max_n_examples_)
+{
+  data = data_;
+  max_n_examples = (max_n_examples_ > 1 ? max_n_examples_ : 1);
+  n_minibatch_examples = 0;
+  DataSet::init(data->n_examples, data->n_inputs, data->n_targets);
+
+  max_n_frames = 0;
+  max_n_target_frames = 0;
+  for(int t=0; t<n_examples; t++)   {
+    int n_frames = 0;
+    int n_target_frames = 0;
+    data->getNumberOfFrames(t, &n_frames, (n_targets > 0 ? &n_target_frames : NULL));
+    if(n_frames > max_n_frames)
+      max_n_frames = n_frames;
+    if(n_target_frames > max_n_target_frames)
+      max_n_target_frames = n_target_frames;
+  }
+
+  long n_batch_frames = (long)max_n_examples*max_n_frames;
+  frame_pointers = (real**)allocator->alloc(sizeof(real*)*(n_batch_frames > 0 ? n_batch_frames : 1));
+  minibatch_frames = (real*)allocator->alloc(sizeof(real)*(n_batch_frames*n_inputs > 0 ? n_batch_frames*n_inputs : 1));
+  inputs = new(allocator) Sequence(frame_pointers, 0, n_inputs);
+
+  target_frame_pointers = NULL;
+  minibatch_target_frames = NULL;
+  targets = NULL;
+  if(n_targets > 0)     {
+    long n_batch_target_frames = (long)max_n_examples*max_n_target_frames;
+    target_frame_pointers = (real**)allocator->alloc(sizeof(real*)*(n_batch_target_frames > 0 ? n_batch_target_frames : 1));
+    minibatch_target_frames = (real*)allocator->alloc(sizeof(real)*(n_batch_target_frames*n_targets > 0 ? n_batch_target_frames*n_targets : 1));
+    targets = new(allocator) Sequence(target_frame_pointers, 0, n_targets);
+  }
+}
+
+void MinibatchDataSet::SetMinibatch(int *examples, int n)
+{
+  if(n > max_n_examples)
+    error("MinibatchDataSet: minibatch of %d examples for at most %d", n, max_n_examples);
+
+  int n_frames = 0;
+  int n_target_frames = 0;
+  for(int b=0; b<n; b++)        {
+    data->setRealExample(selected_examples[examples[b]], true, n_targets > 0);
+
+    Sequence *example_inputs = data->inputs;
+    for(int f=0; f<example_inputs->n_frames; f++)       {
+      real *frame = minibatch_frames + (long)n_frames*n_inputs;
+      memcpy(frame, example_inputs->frames[f], sizeof(real)*n_inputs);
+      frame_pointers[n_frames++] = frame;
+    }
+
+    if(n_targets > 0)   {
+      Sequence *example_targets = data->targets;
+      for(int f=0; f<example_targets->n_frames; f++)    {
+        real *frame = minibatch_target_frames + (long)n_target_frames*n_targets;
+        memcpy(frame, example_targets->frames[f], sizeof(real)*n_targets);
+        target_frame_pointers[n_target_frames++] = frame;
+      }
+    }
+  }
+  inputs->n_frames = n_frames;
+  if(targets)
+    targets->n_frames = n_target_frames;
+
+  n_minibatch_examples = n;
+  real_current_example_index = -1;
+}
+
+void MinibatchDataSet::getNumberOfFrames(int t_, int *n_input_frames_, int *n_target_frames_)
+{
+  int t = selected_examples[t_];
+  data->getNumberOfFrames(t, n_input_frames_, n_target_frames_);
+}
+
+// The examples were already selected by this view: the underlying DataSet is
+// set to the real example directly.
+void MinibatchDataSet::setRealExample(int t, bool set_inputs, bool set_targets)
+{
+  data->setRealExample(t, set_inputs, set_targets);
+
+  if(set_inputs)        {
+    for(int f=0; f<data->inputs->n_frames; f++)
+      frame_pointers[f] = data->inputs->frames[f];
+    inputs->n_frames = data->inputs->n_frames;
+  }
+  if(set_targets && targets)    {
+    for(int f=0; f<data->targets->n_frames; f++)
+      target_frame_pointers[f] = data->targets->frames[f];
+    targets->n_frames = data->targets->n_frames;
+  }
+
+  n_minibatch_examples = 0;
+  real_current_example_index = t;
+}
+
+void MinibatchDataSet::preProcess(PreProcessing *pre_processing)
+{
+  error("MinibatchDataSet: pre-processing not supported");
+}
+
+void MinibatchDataSet::pushExample()
+{
+  error("MinibatchDataSet::pushExample() not supported");
+}
+
+void MinibatchDataSet::popExample()
+{
+  error("MinibatchDataSet::popExample() not supported");
+}
+
+MinibatchDataSet::~MinibatchDataSet()
+{
+}
+
+}
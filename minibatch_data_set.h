@@ -0,0 +1,74 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_MINIBATCH_DATA_SET_H_
+#define TORCH_MINIBATCH_DATA_SET_H_
+
+#include "DataSet.h"
+
+namespace Torch {
+
+// A view of a DataSet that can also set several of its examples at once, as
+// one example whose frames are the frames of the examples one after the
+// other. The machines then run a minibatch through their multi-frame kernels
+// (see Coder::UseFrameKernels), and the criterions see one frame per
+// example.
+//
+// The inputs and targets Sequences of this DataSet are always the same
+// objects, so that the DataSets wrapping this one (InputAsTargetDataSet,
+// DynamicDataSet) get the minibatches as well. A single example points to the
+// frames of the underlying DataSet. A minibatch is copied: the underlying
+// DataSet may reuse its frames from one example to the next.
+//
+class MinibatchDataSet : public DataSet
+{
+  private:
+    MinibatchDataSet(){};
+
+  public:
+    /// The underlying DataSet.
+    DataSet *data;
+
+    // The capacity: examples per minibatch, and frames per example.
+    int max_n_examples;
+    int max_n_frames;
+    int max_n_target_frames;
+
+    real **frame_pointers;
+    real **target_frame_pointers;
+    real *minibatch_frames;
+    real *minibatch_target_frames;
+
+    // Number of examples set by the last SetMinibatch, 0 after a single
+    // example.
+    int n_minibatch_examples;
+
+    MinibatchDataSet(DataSet *data_, int max_n_examples_);
+
+    // Sets the #n# examples #examples# (indices in this DataSet) as the
+    // current example.
+    virtual void SetMinibatch(int *examples, int n);
+
+    virtual void getNumberOfFrames(int t_, int *n_input_frames_, int *n_target_frames_);
+    virtual void setRealExample(int t, bool set_inputs=true, bool set_targets=true);
+    virtual void preProcess(PreProcessing *pre_processing);
+    virtual void pushExample();
+    virtual void popExample();
+
+    virtual ~MinibatchDataSet();
+};
+
+}
+
+#endif // TORCH_MINIBATCH_DATA_SET_H_
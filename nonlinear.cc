@@ -13,6 +13,7 @@
 // limitations under the License.
 //
 #include "nonlinear.h"
+#include "activations.h"
 
 namespace Torch {
 
@@ -20,11 +21,10 @@ Nonlinear::Nonlinear(int n_units) : GradientMachine(n_units, n_units)
 {
 }
 
+// Vectorized through activations.h.
 void Nonlinear::frameForward(int t, real *f_inputs, real *f_outputs)
 {
-  for(int i = 0; i < n_inputs; i++)     {
-    f_outputs[i] = 0.5 * (f_inputs[i]/(1.0 + fabs(f_inputs[i])) + 1.);
-  }
+  ActivateArray(kActivationSoftsign, f_inputs, f_outputs, n_inputs);
 }
 
 void Nonlinear::frameBackward(int t, real *f_inputs, real *beta_, real *f_outputs, real *alpha_)
@@ -32,11 +32,7 @@ void Nonlinear::frameBackward(int t, real *f_inputs, real *beta_, real *f_output
   if(partial_backprop)
     return;
 
-  real z;
-  for(int i = 0; i < n_outputs; i++)    {
-    z = 1.0 + fabs(f_inputs[i]);
-    beta_[i] = 0.5 * alpha_[i] / (z*z);
-  }
+  ActivationBackwardArray(kActivationSoftsign, f_outputs, alpha_, beta_, n_outputs);
 }
 
 Nonlinear::~Nonlinear()
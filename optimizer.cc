@@ -0,0 +1,280 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "optimizer.h"
+#include "simd.h"
+
+namespace Torch {
+
+OptimizerType OptimizerFromName(std::string name)
+{
+  if(name=="sgd")
+    return kOptimizerSgd;
+  else if(name=="momentum")
+    return kOptimizerMomentum;
+  else if(name=="nesterov")
+    return kOptimizerNesterov;
+  else if(name=="adagrad")
+    return kOptimizerAdagrad;
+  else if(name=="rmsprop")
+    return kOptimizerRmsprop;
+  else if(name=="adam")
+    return kOptimizerAdam;
+  error("OptimizerFromName - unknown optimizer %s.", name.c_str());
+  return kOptimizerSgd;
+}
+
+Optimizer::Optimizer()
+{
+  n_steps = 0;
+  n_blocks = 0;
+  block_params = NULL;
+  block_sizes = NULL;
+  block_states = NULL;
+  block_n_states = NULL;
+
+  addIOption("type", &type, kOptimizerSgd, "update rule, see OptimizerType");
+  addROption("momentum", &momentum, 0.9, "decay of the velocity, or of the first moment of adam");
+  addROption("decay rate", &decay_rate, 0.999, "decay of the squared gradients of rmsprop and adam");
+  addROption("epsilon", &epsilon, 1e-8, "added to the root of the squared gradients");
+}
+
+int Optimizer::NumStates()
+{
+  switch(type)  {
+    case kOptimizerSgd:
+      return 0;
+    case kOptimizerAdam:
+      return 2;
+    default:
+      return 1;
+  }
+}
+
+int Optimizer::FindBlock(real *ptr)
+{
+  for(int b=0; b<n_blocks; b++) {
+    if(ptr >= block_params[b] && ptr < block_params[b]+block_sizes[b])
+      return b;
+  }
+  return -1;
+}
+
+void Optimizer::AddBlock(real *params, int n)
+{
+  if(n <= 0 || FindBlock(params) >= 0)
+    return;
+
+  block_params = (real**)allocator->realloc(block_params, sizeof(real*)*(n_blocks+1));
+  block_sizes = (int*)allocator->realloc(block_sizes, sizeof(int)*(n_blocks+1));
+  block_states = (real**)allocator->realloc(block_states, sizeof(real*)*(n_blocks+1));
+  block_n_states = (int*)allocator->realloc(block_n_states, sizeof(int)*(n_blocks+1));
+  block_params[n_blocks] = params;
+  block_sizes[n_blocks] = n;
+  block_states[n_blocks] = NULL;
+  block_n_states[n_blocks] = 0;
+  n_blocks++;
+}
+
+// The states are allocated here, so that the type can be changed between two
+// trainings.
+void Optimizer::AddParameters(Parameters *params)
+{
+  if(params)    {
+    for(int i=0; i<params->n_data; i++)
+      AddBlock(params->data[i], params->size[i]);
+  }
+
+  int n_states = NumStates();
+  for(int b=0; b<n_blocks; b++) {
+    if(block_n_states[b] < n_states)    {
+      allocator->free(block_states[b]);
+      block_states[b] = (real*)allocator->alloc(sizeof(real)*n_states*block_sizes[b]);
+      memset(block_states[b], 0, sizeof(real)*n_states*block_sizes[b]);
+      block_n_states[b] = n_states;
+    }
+  }
+}
+
+void Optimizer::Reset()
+{
+  n_steps = 0;
+  for(int b=0; b<n_blocks; b++)
+    memset(block_states[b], 0, sizeof(real)*block_n_states[b]*block_sizes[b]);
+}
+
+void Optimizer::Step()
+{
+#ifdef _OPENMP
+#pragma omp atomic
+#endif
+  n_steps++;
+}
+
+// The arguments of the kernels. step_rate is the learning rate of the
+// normalized rules, for the averaged gradient.
+struct OptimizerStep {
+  real learning_rate;
+  real inv_n_examples;
+  real step_rate;
+  real momentum;
+  real decay_rate;
+  real epsilon;
+};
+
+static inline real Sqrt(real x)
+{
+  return sqrt(x);
+}
+
+static inline simd_real Sqrt(simd_real x)
+{
+  for(int k=0; k<kSimdWidth; k++)
+    x[k] = sqrt(x[k]);
+  return x;
+}
+
+// The update of one vector of parameters (T=simd_real), or of one real.
+// d is the gradient summed over the examples.
+template <int type, typename T>
+static inline T UpdateValue(T p, T d, T *s0, T *s1, const OptimizerStep &step)
+{
+  switch(type)  {
+    case kOptimizerMomentum:
+      *s0 = step.momentum * *s0 - step.learning_rate * d;
+      return p + *s0;
+    case kOptimizerNesterov:
+      {
+        T lr_d = step.learning_rate * d;
+        *s0 = step.momentum * *s0 - lr_d;
+        return p + step.momentum * *s0 - lr_d;
+      }
+    case kOptimizerAdagrad:
+      {
+        T g = step.inv_n_examples * d;
+        *s0 = *s0 + g*g;
+        return p - step.learning_rate * d / (Sqrt(*s0) + step.epsilon);
+      }
+    case kOptimizerRmsprop:
+      {
+        T g = step.inv_n_examples * d;
+        *s0 = step.decay_rate * *s0 + (1 - step.decay_rate) * g*g;
+        return p - step.learning_rate * d / (Sqrt(*s0) + step.epsilon);
+      }
+    case kOptimizerAdam:
+      {
+        T g = step.inv_n_examples * d;
+        *s1 = step.momentum * *s1 + (1 - step.momentum) * g;
+        *s0 = step.decay_rate * *s0 + (1 - step.decay_rate) * g*g;
+        return p - step.step_rate * *s1 / (Sqrt(*s0) + step.epsilon);
+      }
+    default:
+      return p - step.learning_rate * d;
+  }
+}
+
+// s0 and s1 are the state arrays, or NULL if the rule has fewer.
+template <int type, bool clear>
+static void UpdateArray(real *params, real *der_params, real *s0, real *s1, int n,
+                        const OptimizerStep &step)
+{
+  simd_real zero = SimdSplat(0.);
+  simd_real dummy = zero;
+  int n_simd = SimdFloor(n);
+  int j=0;
+  for(; j<n_simd; j+=kSimdWidth)    {
+    simd_real v0 = (s0 ? SimdLoad(s0+j) : zero);
+    simd_real v1 = (s1 ? SimdLoad(s1+j) : zero);
+    SimdStore(params+j, UpdateValue<type>(SimdLoad(params+j), SimdLoad(der_params+j),
+                                          s0 ? &v0 : &dummy, s1 ? &v1 : &dummy, step));
+    if(s0)
+      SimdStore(s0+j, v0);
+    if(s1)
+      SimdStore(s1+j, v1);
+    if(clear)
+      SimdStore(der_params+j, zero);
+  }
+  real scalar_dummy = 0;
+  for(; j<n; j++)   {
+    params[j] = UpdateValue<type>(params[j], der_params[j],
+                                  s0 ? s0+j : &scalar_dummy, s1 ? s1+j : &scalar_dummy, step);
+    if(clear)
+      der_params[j] = 0;
+  }
+}
+
+template <int type>
+static void UpdateArrayT(bool clear, real *params, real *der_params, real *s0, real *s1,
+                         int n, const OptimizerStep &step)
+{
+  if(clear)
+    UpdateArray<type, true>(params, der_params, s0, s1, n, step);
+  else
+    UpdateArray<type, false>(params, der_params, s0, s1, n, step);
+}
+
+// Goes through the blocks the parameters span, as a run of an arena may
+// cover a few blocks of AddParameters.
+void Optimizer::Update(real *params, real *der_params, int n, real learning_rate,
+                       int n_examples, bool clear)
+{
+  OptimizerStep step;
+  step.learning_rate = learning_rate;
+  step.inv_n_examples = 1. / (real)(n_examples > 0 ? n_examples : 1);
+  step.momentum = momentum;
+  step.decay_rate = decay_rate;
+  step.epsilon = epsilon;
+  step.step_rate = learning_rate * (real)(n_examples > 0 ? n_examples : 1);
+  if(type == kOptimizerAdam)    {
+    int t = (n_steps > 0 ? n_steps : 1);
+    step.step_rate *= sqrt(1. - pow(decay_rate, t)) / (1. - pow(momentum, t));
+  }
+
+  int n_states = NumStates();
+  while(n > 0)  {
+    int size = n;
+    real *s0 = NULL;
+    real *s1 = NULL;
+    if(n_states > 0)    {
+      int b = FindBlock(params);
+      if(b < 0 || block_n_states[b] < n_states)
+        error("Optimizer::Update - parameters without state, see AddParameters.");
+      int offset = params - block_params[b];
+      if(block_sizes[b] - offset < size)
+        size = block_sizes[b] - offset;
+      s0 = block_states[b] + offset;
+      if(n_states > 1)
+        s1 = s0 + block_sizes[b];
+    }
+
+    switch(type)    {
+      case kOptimizerMomentum: UpdateArrayT<kOptimizerMomentum>(clear, params, der_params, s0, s1, size, step); break;
+      case kOptimizerNesterov: UpdateArrayT<kOptimizerNesterov>(clear, params, der_params, s0, s1, size, step); break;
+      case kOptimizerAdagrad: UpdateArrayT<kOptimizerAdagrad>(clear, params, der_params, s0, s1, size, step); break;
+      case kOptimizerRmsprop: UpdateArrayT<kOptimizerRmsprop>(clear, params, der_params, s0, s1, size, step); break;
+      case kOptimizerAdam: UpdateArrayT<kOptimizerAdam>(clear, params, der_params, s0, s1, size, step); break;
+      default: UpdateArrayT<kOptimizerSgd>(clear, params, der_params, s0, s1, size, step);
+    }
+
+    params += size;
+    der_params += size;
+    n -= size;
+  }
+}
+
+Optimizer::~Optimizer()
+{
+}
+
+}
@@ -0,0 +1,104 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_OPTIMIZER_H_
+#define TORCH_OPTIMIZER_H_
+
+#include "Object.h"
+#include "Parameters.h"
+#include <string>
+
+namespace Torch {
+
+// The update rules of StochasticGradientPlus.
+//
+// With g the gradient averaged over the minibatch and lr the learning rate:
+//   - sgd:      p -= lr g
+//   - momentum: v = mu v - lr g, p += v
+//   - nesterov: v = mu v - lr g, p += mu v - lr g
+//   - adagrad:  s += g^2, p -= lr g / (sqrt(s) + eps)
+//   - rmsprop:  s = rho s + (1-rho) g^2, p -= lr g / (sqrt(s) + eps)
+//   - adam:     m = mu m + (1-mu) g, s = rho s + (1-rho) g^2,
+//               p -= lr sqrt(1-rho^t)/(1-mu^t) m / (sqrt(s) + eps)
+// mu is the "momentum" option and rho the "decay rate" one. The weight decay
+// of the Coders is applied separately, with the plain learning rate.
+enum OptimizerType {
+  kOptimizerSgd = 0,
+  kOptimizerMomentum,
+  kOptimizerNesterov,
+  kOptimizerAdagrad,
+  kOptimizerRmsprop,
+  kOptimizerAdam
+};
+
+// The type for a name ("sgd", "momentum", ...). Errors on unknown names.
+OptimizerType OptimizerFromName(std::string name);
+
+// Applies one of the rules above to parameter arrays, and keeps their state
+// (v, s, m).
+//
+// The state lives in blocks laid out like the parameters: the state of the
+// real at params+j of a block is at state+j. A block is usually a whole
+// ParameterArena (see AddBlock), so that the runs of NextParameterRun are
+// runs of the state as well. Arrays outside any block get their own when
+// first seen by AddParameters.
+//
+// Subclasses can implement other rules by overriding Update.
+class Optimizer : public Object
+{
+  public:
+    int type;
+    real momentum;
+    real decay_rate;
+    real epsilon;
+    int n_steps;          // for the bias correction of adam
+
+    int n_blocks;
+    real **block_params;
+    int *block_sizes;
+    real **block_states;    // block_n_states arrays of the block size each
+    int *block_n_states;
+
+    Optimizer();
+
+    // The number of state arrays of the rule.
+    virtual int NumStates();
+
+    // Registers the parameters [params, params+n) as one block.
+    virtual void AddBlock(real *params, int n);
+    // Makes sure every array of #params# is in a block. Must be called
+    // before the updates, out of the threads.
+    virtual void AddParameters(Parameters *params);
+    // Zeroes the state and the step count.
+    virtual void Reset();
+
+    // Counts one update of the whole model, for the bias correction.
+    virtual void Step();
+
+    // Updates the #n# parameters at #params#, given the sum of their
+    // gradients over #n_examples# examples in #der_params#. #learning_rate#
+    // is already divided by #n_examples#, as in UpdateMachine. With #clear#,
+    // #der_params# are zeroed in the same sweep.
+    virtual void Update(real *params, real *der_params, int n, real learning_rate,
+                        int n_examples, bool clear);
+
+    // The block holding #ptr#, or -1.
+    int FindBlock(real *ptr);
+
+    virtual ~Optimizer();
+};
+
+}
+
+#endif  // TORCH_OPTIMIZER_H_
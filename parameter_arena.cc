@@ -0,0 +1,175 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "parameter_arena.h"
+#include "transposed_tied_linear.h"
+
+namespace Torch {
+
+static const int kArenaAlignment = 64;
+
+// An allocation of the allocator, aligned for the widest SIMD loads.
+static real *AlignedAlloc(Allocator *allocator, int n_reals)
+{
+  char *raw = (char*)allocator->alloc(n_reals*sizeof(real) + kArenaAlignment);
+  size_t offset = (kArenaAlignment - ((size_t)raw % kArenaAlignment)) % kArenaAlignment;
+  return (real*)(raw + offset);
+}
+
+ParameterArena::ParameterArena()
+{
+  n_reals = 0;
+  params = NULL;
+  der_params = NULL;
+  n_layers = 0;
+  layers = NULL;
+  move_params = NULL;
+  n_arrays = 0;
+  old_arrays = NULL;
+  new_arrays = NULL;
+  array_sizes = NULL;
+  old_lists = NULL;
+  n_old_lists = 0;
+}
+
+void ParameterArena::AddLayer(Linear *layer, bool move_params_)
+{
+  layers = (Linear**)allocator->realloc(layers, sizeof(Linear*)*(n_layers+1));
+  move_params = (bool*)allocator->realloc(move_params, sizeof(bool)*(n_layers+1));
+  layers[n_layers] = layer;
+  move_params[n_layers] = move_params_;
+  n_layers++;
+}
+
+void ParameterArena::Pack()
+{
+  if(params)
+    error("ParameterArena::Pack() - already packed.");
+
+  // The arrays to move. The params and der_params of a layer have the same
+  // sizes, and go at the same offsets of the two blocks.
+  n_arrays = 0;
+  for(int l=0; l<n_layers; l++)
+    n_arrays += 2*layers[l]->params->n_data;
+  old_arrays = (real**)allocator->alloc(sizeof(real*)*n_arrays);
+  new_arrays = (real**)allocator->alloc(sizeof(real*)*n_arrays);
+  array_sizes = (int*)allocator->alloc(sizeof(int)*n_arrays);
+
+  old_lists = (Parameters**)allocator->alloc(sizeof(Parameters*)*2*n_layers);
+  n_old_lists = 0;
+
+  n_reals = 0;
+  for(int l=0; l<n_layers; l++)     {
+    for(int i=0; i<layers[l]->params->n_data; i++)
+      n_reals += layers[l]->params->size[i];
+  }
+  params = AlignedAlloc(allocator, n_reals);
+  der_params = AlignedAlloc(allocator, n_reals);
+
+  int offset = 0;
+  int index = 0;
+  for(int l=0; l<n_layers; l++)     {
+    Linear *layer = layers[l];
+    Parameters *new_params = new(layer->allocator) Parameters(0);
+    Parameters *new_der_params = new(layer->allocator) Parameters(0);
+
+    for(int i=0; i<layer->params->n_data; i++)      {
+      int size = layer->params->size[i];
+      real *param_array = layer->params->data[i];
+      if(move_params[l])        {
+        memcpy(params+offset, param_array, sizeof(real)*size);
+        old_arrays[index] = param_array;
+        new_arrays[index] = params+offset;
+        array_sizes[index] = size;
+        index++;
+        param_array = params+offset;
+      }
+      new_params->addParameters(param_array, size);
+
+      memcpy(der_params+offset, layer->der_params->data[i], sizeof(real)*size);
+      old_arrays[index] = layer->der_params->data[i];
+      new_arrays[index] = der_params+offset;
+      array_sizes[index] = size;
+      index++;
+      new_der_params->addParameters(der_params+offset, size);
+
+      offset += size;
+    }
+
+    old_lists[n_old_lists++] = layer->params;
+    old_lists[n_old_lists++] = layer->der_params;
+    layer->params = new_params;
+    layer->der_params = new_der_params;
+  }
+  n_arrays = index;
+
+  // The pointers of the layers, including the tied ones into other layers.
+  for(int l=0; l<n_layers; l++)     {
+    Linear *layer = layers[l];
+    layer->weights = Remap(layer->weights);
+    layer->der_weights = Remap(layer->der_weights);
+    layer->bias = Remap(layer->bias);
+    layer->der_bias = Remap(layer->der_bias);
+  }
+}
+
+real *ParameterArena::Remap(real *ptr)
+{
+  for(int i=0; i<n_arrays; i++) {
+    if(ptr >= old_arrays[i] && ptr < old_arrays[i]+array_sizes[i])
+      return new_arrays[i] + (ptr - old_arrays[i]);
+  }
+  return ptr;
+}
+
+void ParameterArena::Remap(Parameters *parameters)
+{
+  if(!parameters)
+    return;
+  for(int i=0; i<parameters->n_data; i++)
+    parameters->data[i] = Remap(parameters->data[i]);
+}
+
+// The old arrays go with the old lists, if the layers owned them.
+void ParameterArena::ReleaseOldArrays()
+{
+  for(int i=0; i<n_layers; i++)   {
+    layers[i]->allocator->free(old_lists[2*i]);
+    layers[i]->allocator->free(old_lists[2*i+1]);
+  }
+  n_old_lists = 0;
+  n_arrays = 0;
+}
+
+ParameterArena::~ParameterArena()
+{
+}
+
+int NextParameterRun(Parameters *a, Parameters *b, int i, int *run_size,
+                     const bool *mask)
+{
+  int size = a->size[i];
+  int next = i+1;
+  while(next < a->n_data
+        && (!mask || mask[next])
+        && a->data[next] == a->data[next-1] + a->size[next-1]
+        && (!b || b->data[next] == b->data[next-1] + b->size[next-1]))      {
+    size += a->size[next];
+    next++;
+  }
+  *run_size = size;
+  return next;
+}
+
+}
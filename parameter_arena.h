@@ -0,0 +1,86 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_PARAMETER_ARENA_H_
+#define TORCH_PARAMETER_ARENA_H_
+
+#include "Object.h"
+#include "Parameters.h"
+#include "Linear.h"
+
+namespace Torch {
+
+// One contiguous, 64-byte aligned block holding the parameters of a set of
+// Linear layers, and another one for their derivatives.
+//
+// The layers are added in order and moved into the arena by Pack(): their
+// arrays are copied back to back, and each layer then reads its own part of
+// the arena as before. The Parameters lists of the machines built on these
+// layers (Coders, ConnectedMachines) hold copies of the old pointers and
+// must be remapped.
+//
+// The arrays of consecutive layers are adjacent, so a machine's parameters
+// come in a few runs (see NextParameterRun) that can be swept, copied or
+// reduced at once.
+//
+class ParameterArena : public Object
+{
+  public:
+    int n_reals;
+    real *params;
+    real *der_params;
+
+    // The layers, and whether their parameters are moved, or only their
+    // derivatives (when the parameters are shared with another model).
+    int n_layers;
+    Linear **layers;
+    bool *move_params;
+
+    // The arrays moved by Pack, and where they went, until ReleaseOldArrays.
+    int n_arrays;
+    real **old_arrays;
+    real **new_arrays;
+    int *array_sizes;
+    Parameters **old_lists;
+    int n_old_lists;
+
+    ParameterArena();
+
+    virtual void AddLayer(Linear *layer, bool move_params_=true);
+
+    // Moves the arrays of the layers into the arena, and points the layers
+    // to them.
+    virtual void Pack();
+
+    // The new place of a pointer into a moved array, or #ptr# itself.
+    virtual real *Remap(real *ptr);
+    // Remaps the arrays of a Parameters list in place.
+    virtual void Remap(Parameters *parameters);
+
+    // Frees the old arrays, once everything is remapped.
+    virtual void ReleaseOldArrays();
+
+    virtual ~ParameterArena();
+};
+
+// The arrays #i#, #i#+1... of #a# that follow each other in memory, and whose
+// counterparts in #b# (if not NULL) do as well. Returns the index after the
+// run and its total size in #run_size#. With a #mask#, the run stops at the
+// first array whose entry is false.
+int NextParameterRun(Parameters *a, Parameters *b, int i, int *run_size,
+                     const bool *mask=NULL);
+
+}
+
+#endif // TORCH_PARAMETER_ARENA_H_
@@ -0,0 +1,68 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "shared_data_set.h"
+
+namespace Torch {
+
+SharedDataSet::SharedDataSet(DataSet *data_)
+{
+  data = data_;
+  DataSet::init(data->n_examples, data->n_inputs, data->n_targets);
+}
+
+void SharedDataSet::getNumberOfFrames(int t_, int *n_input_frames_, int *n_target_frames_)
+{
+  int t = selected_examples[t_];
+#ifdef _OPENMP
+#pragma omp critical(shared_data_set)
+#endif
+  data->getNumberOfFrames(t, n_input_frames_, n_target_frames_);
+}
+
+// The examples were already selected by this view: the underlying DataSet is
+// set to the real example directly.
+void SharedDataSet::setRealExample(int t, bool set_inputs, bool set_targets)
+{
+#ifdef _OPENMP
+#pragma omp critical(shared_data_set)
+#endif
+  {
+    data->setRealExample(t, set_inputs, set_targets);
+    inputs = data->inputs;
+    targets = data->targets;
+  }
+  real_current_example_index = t;
+}
+
+void SharedDataSet::preProcess(PreProcessing *pre_processing)
+{
+  error("SharedDataSet: pre-processing not supported");
+}
+
+void SharedDataSet::pushExample()
+{
+  error("SharedDataSet::pushExample() not supported");
+}
+
+void SharedDataSet::popExample()
+{
+  error("SharedDataSet::popExample() not supported");
+}
+
+SharedDataSet::~SharedDataSet()
+{
+}
+
+}
@@ -0,0 +1,52 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_SHARED_DATA_SET_H_
+#define TORCH_SHARED_DATA_SET_H_
+
+#include "DataSet.h"
+
+namespace Torch {
+
+// A view of a DataSet for one of several threads.
+//
+// The example is set on the underlying DataSet and its inputs and targets
+// are taken while holding a lock, so each thread has its own current example
+// as long as the underlying DataSet hands out Sequences that stay valid, as
+// the memory DataSets do. Only the views should be used while the threads
+// run.
+//
+class SharedDataSet : public DataSet
+{
+  private:
+    SharedDataSet(){};
+
+  public:
+    /// The underlying DataSet.
+    DataSet *data;
+
+    SharedDataSet(DataSet *data_);
+
+    virtual void getNumberOfFrames(int t_, int *n_input_frames_, int *n_target_frames_);
+    virtual void setRealExample(int t, bool set_inputs=true, bool set_targets=true);
+    virtual void preProcess(PreProcessing *pre_processing);
+    virtual void pushExample();
+    virtual void popExample();
+
+    virtual ~SharedDataSet();
+};
+
+}
+
+#endif // TORCH_SHARED_DATA_SET_H_
@@ -0,0 +1,71 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "sigmoid_cross_entropy_criterion.h"
+#include "coder.h"
+#include "Linear.h"
+#include "activations.h"
+
+namespace Torch {
+
+SigmoidCrossEntropyCriterion::SigmoidCrossEntropyCriterion(Coder *coder_)
+    : Criterion(coder_->n_outputs)
+{
+  coder = coder_;
+  if(BaseNonlinearity(coder->nonlinearity) != "sigmoid")
+    error("SigmoidCrossEntropyCriterion - the coder's nonlinearity must be a sigmoid!");
+  coder->setAlphaOnPreActivations(true);
+
+  addBOption("average frame size", &average_frame_size, true, "divided by the frame size");
+}
+
+void SigmoidCrossEntropyCriterion::frameForward(int t, real *f_inputs, real *f_outputs)
+{
+  real *desired = data->targets->frames[t];
+  real *pre_activations = coder->linear_layer->outputs->frames[t];
+  real err = 0.;
+
+  for(int i=0; i<n_inputs; i++)     {
+    real a = pre_activations[i];
+    err += (a > 0. ? a : 0.) - desired[i] * a + log1p(exp(-fabs(a)));
+  }
+
+  if(average_frame_size)        {
+    err /= n_inputs;
+  }
+
+  f_outputs[0] = err;
+}
+
+void SigmoidCrossEntropyCriterion::frameBackward(int t, real *f_inputs, real *beta_, real *f_outputs, real *alpha_)
+{
+  real *desired = data->targets->frames[t];
+  real *pre_activations = coder->linear_layer->outputs->frames[t];
+  real norm = (average_frame_size ? 1./n_inputs : 1.);
+
+  // The exact sigmoid of a, as in the forward: f_inputs is approximated
+  // with "sigmoid_table" or "sigmoid_fast".
+  for(int i = 0; i < n_inputs; i++)     {
+    real a = pre_activations[i];
+    real e = exp(-fabs(a));
+    real f = (a >= 0. ? 1./(1.+e) : e/(1.+e));
+    beta_[i] = norm * (f-desired[i]);
+  }
+}
+
+SigmoidCrossEntropyCriterion::~SigmoidCrossEntropyCriterion()
+{
+}
+
+}
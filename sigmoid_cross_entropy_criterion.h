@@ -0,0 +1,54 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_SIGMOID_CROSS_ENTROPY_CRITERION_H_
+#define TORCH_SIGMOID_CROSS_ENTROPY_CRITERION_H_
+
+#include "Criterion.h"
+
+namespace Torch {
+
+class Coder;
+
+// Cross entropy criterion fused with the sigmoid of a Coder.
+//
+// Like CrossEntropyCriterion, its inputs are the outputs f = sigmoid(a) of
+// the coder, but the cost is computed from the pre-activations a:
+//   softplus(a) - t*a = max(a,0) - t*a + log(1+exp(-|a|)),
+// which doesn't overflow when the units saturate. Its beta is the derivative
+// with respect to a, sigmoid(a) - t, also computed exactly from a when the
+// coder approximates its sigmoid: the coder is set to skip the backward of
+// its nonlinearity (see Coder::setAlphaOnPreActivations).
+//
+class SigmoidCrossEntropyCriterion : public Criterion
+{
+  public:
+    bool average_frame_size;
+    Coder *coder;
+
+
+    SigmoidCrossEntropyCriterion(Coder *coder_);
+
+    //-----
+
+    virtual void frameForward(int t, real *f_inputs, real *f_outputs);
+    virtual void frameBackward(int t, real *f_inputs, real *beta_, real *f_outputs, real *alpha_);
+
+    virtual ~SigmoidCrossEntropyCriterion();
+};
+
+}
+
+
+#endif  // TORCH_SIGMOID_CROSS_ENTROPY_CRITERION_H_
@@ -0,0 +1,103 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_SIMD_H_
+#define TORCH_SIMD_H_
+
+#include "general.h"
+#include <stdint.h>
+
+namespace Torch {
+
+// A thin layer over the gcc vector extensions. The width of simd_real follows
+// the instruction set the code is compiled for (-mavx512f, -mavx2, ...), so
+// the same kernels give AVX-512, AVX or SSE code.
+//
+// simd_real is only aligned like a real: loads and stores may be unaligned.
+
+#if defined(__AVX512F__)
+#define TORCH_SIMD_BYTES 64
+#elif defined(__AVX__)
+#define TORCH_SIMD_BYTES 32
+#else
+#define TORCH_SIMD_BYTES 16
+#endif
+
+typedef real simd_real __attribute__((vector_size(TORCH_SIMD_BYTES), aligned(sizeof(real))));
+
+// Integer lanes of the same width as the reals, for masks.
+#ifdef USE_DOUBLE
+typedef int64_t simd_mask_lane;
+#else
+typedef int32_t simd_mask_lane;
+#endif
+typedef simd_mask_lane simd_mask __attribute__((vector_size(TORCH_SIMD_BYTES), aligned(sizeof(real))));
+
+// Number of reals in a simd_real.
+static const int kSimdWidth = TORCH_SIMD_BYTES / sizeof(real);
+
+static inline simd_real SimdLoad(const real *p)
+{
+  simd_real v;
+  memcpy(&v, p, sizeof(simd_real));
+  return v;
+}
+
+static inline void SimdStore(real *p, simd_real v)
+{
+  memcpy(p, &v, sizeof(simd_real));
+}
+
+// All the lanes set to x.
+static inline simd_real SimdSplat(real x)
+{
+  simd_real v;
+  for(int k=0; k<kSimdWidth; k++)
+    v[k] = x;
+  return v;
+}
+
+// Sum of the lanes.
+static inline real SimdSum(simd_real v)
+{
+  real sum = 0.;
+  for(int k=0; k<kSimdWidth; k++)
+    sum += v[k];
+  return sum;
+}
+
+// A mask with all the bits of lane k set iff bit k of bits is set.
+static inline simd_mask SimdMaskFromBits(uint64_t bits)
+{
+  simd_mask m;
+  for(int k=0; k<kSimdWidth; k++)
+    m[k] = -(simd_mask_lane)((bits >> k) & 1);
+  return m;
+}
+
+// Lanes of a where the mask is set, of b elsewhere.
+static inline simd_real SimdSelect(simd_mask m, simd_real a, simd_real b)
+{
+  return (simd_real)((m & (simd_mask)a) | (~m & (simd_mask)b));
+}
+
+// Largest multiple of kSimdWidth not above n.
+static inline int SimdFloor(int n)
+{
+  return n - (n % kSimdWidth);
+}
+
+}
+
+#endif  // TORCH_SIMD_H_
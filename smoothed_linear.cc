@@ -13,112 +13,102 @@
 // limitations under the License.
 //
 #include "smoothed_linear.h"
-#include <cassert>
+#include "simd.h"
 
 namespace Torch {
 
 SmoothedLinear::SmoothedLinear(int n_inputs_, int n_outputs_) : Linear(n_inputs_, n_outputs_)
 {
-  warning("SmoothedLinear - Assuming input is a square image!");
-  input_sub_unit_size = (int) sqrt(n_inputs);
-  input_n_sub_units = input_sub_unit_size;
-  assert( (input_sub_unit_size*input_n_sub_units) == n_inputs);
-
+  // Default to a square image, or to a single row if n_inputs is not a square.
+  int side = (int) sqrt((real)n_inputs);
+  while((side+1)*(side+1) <= n_inputs)
+    side++;
+  int default_width = side;
+  int default_height = side;
+  if(side*side != n_inputs)     {
+    warning("SmoothedLinear - %d inputs is not a square image. Set the input width and height.", n_inputs);
+    default_width = n_inputs;
+    default_height = 1;
+  }
+
+  addIOption("input width", &input_sub_unit_size, default_width, "width of the input image");
+  addIOption("input height", &input_n_sub_units, default_height, "height of the input image");
   addROption("l1 smoothing weight decay", &l1_smoothing_weight_decay, 0., "l1_smoothing weight decay");
   addROption("l2 smoothing weight decay", &l2_smoothing_weight_decay, 0., "l2_smoothing weight decay");
 }
 
-void SmoothedLinear::frameBackward(int t, real *f_inputs, real *beta_, real *f_outputs, real *alpha_)
+// Gradient of the decay for the difference delta between a weight and one of
+// its neighbours. A delta of 0 counts as positive for the l1 part.
+static inline simd_real SmoothingTerm(simd_real delta, simd_real l1, simd_real minus_l1, simd_real l2)
 {
-  Linear::frameBackward(t, f_inputs, beta_, f_outputs, alpha_);
-
-  // Apply smoothing weight decay.
-  if (l1_smoothing_weight_decay != 0. || l2_smoothing_weight_decay != 0.)  {
-    real *src_ = params->data[0];
-    real *dest_ = der_params->data[0];
-
-    int offset=0;
-    real delta=0.0;
-
-    bool is_l1_decayed = false;
-    bool is_l2_decayed = false;
-    if (l1_smoothing_weight_decay > 0.0)
-      is_l1_decayed = true;
-    if (l2_smoothing_weight_decay > 0.0)
-      is_l2_decayed = true;
-
-    // the gradient will be SUBSTRACTED. We add negative the correction to it.
-    for(int i=0; i<n_outputs; i++) {
-      for (int j=0; j<input_n_sub_units; j++) {
-        for (int k=0; k<input_sub_unit_size; k++) {
-
-          // not considering the equal cases...
-          // from left - not when k==0
-          if (k) {
-            delta = src_[offset] - src_[offset-1];
-
-            if (is_l1_decayed)  {
-              if(delta<0.0)
-                dest_[offset] -= l1_smoothing_weight_decay;
-              else
-                dest_[offset] += l1_smoothing_weight_decay;
-            }
-
-            if (is_l2_decayed)
-              dest_[offset] += l2_smoothing_weight_decay * delta;
-          }
-
-          // from right
-          if (k != (input_sub_unit_size-1)) { // not on right border
-            delta = src_[offset] - src_[offset+1];
-
-            if(is_l1_decayed) {
-              if(delta<0.0)
-                dest_[offset] -= l1_smoothing_weight_decay;
-              else
-                dest_[offset] += l1_smoothing_weight_decay;
-            }
-
-            if (is_l2_decayed)
-              dest_[offset] += l2_smoothing_weight_decay * delta;
-          }
-
-          // from top
-          if (j) { // not on top border
-            delta = src_[offset] - src_[offset-input_sub_unit_size];
-
-            if(is_l1_decayed) {
-              if(delta<0.0)
-                dest_[offset] -= l1_smoothing_weight_decay;
-              else
-                dest_[offset] += l1_smoothing_weight_decay;
-            }
-
-            if (is_l2_decayed)
-              dest_[offset] += l2_smoothing_weight_decay * delta;
-          }
-
-          // from bottom
-          if (j<input_n_sub_units-1) { // not on bottom border 
-            delta = src_[offset] - src_[offset+input_sub_unit_size];
+  return l2 * delta + SimdSelect(delta < SimdSplat(0.), minus_l1, l1);
+}
 
-            if (is_l1_decayed) {
-              if (delta < 0.0)
-                dest_[offset] -= l1_smoothing_weight_decay;
-              else
-                dest_[offset] += l1_smoothing_weight_decay;
-            }
+static inline real SmoothingTerm(real delta, real l1, real l2)
+{
+  return l2 * delta + (delta < 0. ? -l1 : l1);
+}
 
-            if (is_l2_decayed)
-              dest_[offset] += l2_smoothing_weight_decay * delta;
-          }
+// The gradient for the weight in column k of the image row starting at src_.
+static inline real SmoothingGradientAt(real *src_, int k, int width, bool has_top, bool has_bottom,
+                                       real l1, real l2)
+{
+  real w = src_[k];
+  real g = 0.;
+  if(k > 0)
+    g += SmoothingTerm(w - src_[k-1], l1, l2);
+  if(k < width-1)
+    g += SmoothingTerm(w - src_[k+1], l1, l2);
+  if(has_top)
+    g += SmoothingTerm(w - src_[k-width], l1, l2);
+  if(has_bottom)
+    g += SmoothingTerm(w - src_[k+width], l1, l2);
+  return g;
+}
 
-          //
-          offset++;
-        }
+void SmoothedLinear::AddSmoothingGradient(real n_examples)
+{
+  if(l1_smoothing_weight_decay == 0. && l2_smoothing_weight_decay == 0.)
+    return;
+
+  int width = input_sub_unit_size;
+  int height = input_n_sub_units;
+  if(width*height != n_inputs)
+    error("SmoothedLinear - the input image is %d x %d but there are %d inputs.", width, height, n_inputs);
+
+  // The gradient will be SUBSTRACTED. We add the correction to it, scaled by
+  // the number of examples.
+  real l1 = (l1_smoothing_weight_decay > 0. ? n_examples * l1_smoothing_weight_decay : 0.);
+  real l2 = (l2_smoothing_weight_decay > 0. ? n_examples * l2_smoothing_weight_decay : 0.);
+  simd_real l1_ = SimdSplat(l1);
+  simd_real minus_l1_ = SimdSplat(-l1);
+  simd_real l2_ = SimdSplat(l2);
+
+  for(int o=0; o<n_outputs; o++)  {
+    for(int j=0; j<height; j++) {
+      real *src_ = weights + o*n_inputs + j*width;
+      real *dest_ = der_weights + o*n_inputs + j*width;
+      bool has_top = (j > 0);
+      bool has_bottom = (j < height-1);
+
+      // The first column, then the interior of the row, which has both
+      // horizontal neighbours, then what is left.
+      dest_[0] += SmoothingGradientAt(src_, 0, width, has_top, has_bottom, l1, l2);
+      int k = 1;
+      for(; k+kSimdWidth<=width-1; k+=kSimdWidth)  {
+        simd_real w = SimdLoad(src_+k);
+        simd_real g = SmoothingTerm(w - SimdLoad(src_+k-1), l1_, minus_l1_, l2_);
+        g += SmoothingTerm(w - SimdLoad(src_+k+1), l1_, minus_l1_, l2_);
+        if(has_top)
+          g += SmoothingTerm(w - SimdLoad(src_+k-width), l1_, minus_l1_, l2_);
+        if(has_bottom)
+          g += SmoothingTerm(w - SimdLoad(src_+k+width), l1_, minus_l1_, l2_);
+        SimdStore(dest_+k, SimdLoad(dest_+k) + g);
       }
-    } // for n_outputs
-  } // if
+      for(; k<width; k++)
+        dest_[k] += SmoothingGradientAt(src_, k, width, has_top, has_bottom, l1, l2);
+    }
+  }
 }
 
 SmoothedLinear::~SmoothedLinear()
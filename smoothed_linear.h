@@ -20,21 +20,26 @@
 namespace Torch {
 
 // A modified Linear Layer with a weight decay that tries to maintain
-// neighbouring weights of a neuron close. Assumes the input is a square
-// (NxN) image.
+// neighbouring weights of a neuron close. The input is an image of
+// "input width" by "input height" (square by default).
+//
+// The smoothing decay only depends on the weights, so it is not added in
+// frameBackward: the trainer calls AddSmoothingGradient once per update, with
+// the number of examples the update is for.
 class SmoothedLinear : public Linear
 {
   public:
-    int input_sub_unit_size;
-    int input_n_sub_units;
+    int input_sub_unit_size;    // width of the image
+    int input_n_sub_units;      // height of the image
     real l1_smoothing_weight_decay;
     real l2_smoothing_weight_decay;
 
     ///
     SmoothedLinear(int n_inputs_, int n_outputs_);
 
-    //-----
-    virtual void frameBackward(int t, real *f_inputs, real *beta_, real *f_outputs, real *alpha_);
+    // Adds #n_examples# times the gradient of the smoothing decay to the
+    // weight derivatives, as a 4-neighbour stencil over each output's image.
+    virtual void AddSmoothingGradient(real n_examples);
 
     virtual ~SmoothedLinear();
 };
@@ -0,0 +1,51 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "softmax_class_measurer.h"
+
+namespace Torch {
+
+SoftmaxClassMeasurer::SoftmaxClassMeasurer(Sequence *inputs_, DataSet *data_, ClassFormat *class_format_,
+                                           XFile *file_, SoftmaxNLLCriterion *criterion_,
+                                           bool calc_confusion_at_each_iter_)
+    : ClassMeasurer(inputs_, data_, class_format_, file_, calc_confusion_at_each_iter_)
+{
+  criterion = criterion_;
+}
+
+// Same as ClassMeasurer::measureExample, with the cached classes.
+void SoftmaxClassMeasurer::measureExample()
+{
+  if(!criterion->IsCached(data))        {
+    ClassMeasurer::measureExample();
+    return;
+  }
+
+  for(int i = 0; i < inputs->n_frames; i++)     {
+    int c_obs = criterion->predicted_classes[i];
+    int c_des = criterion->target_classes[i];
+
+    if(c_obs != c_des)
+      internal_error += 1.;
+
+    if(calc_confusion_at_each_iter)
+      confusion[c_obs][c_des]++;
+  }
+}
+
+SoftmaxClassMeasurer::~SoftmaxClassMeasurer()
+{
+}
+
+}
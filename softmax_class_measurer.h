@@ -0,0 +1,42 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_SOFTMAX_CLASS_MEASURER_H_
+#define TORCH_SOFTMAX_CLASS_MEASURER_H_
+
+#include "ClassMeasurer.h"
+#include "softmax_nll_criterion.h"
+
+namespace Torch {
+
+// A ClassMeasurer that takes the classes from the cache of a
+// SoftmaxNLLCriterion when it holds the current example, as it does for the
+// training set.
+//
+class SoftmaxClassMeasurer : public ClassMeasurer
+{
+  public:
+    SoftmaxNLLCriterion *criterion;
+
+    SoftmaxClassMeasurer(Sequence *inputs_, DataSet *data_, ClassFormat *class_format_, XFile *file_,
+                         SoftmaxNLLCriterion *criterion_, bool calc_confusion_at_each_iter_=false);
+
+    virtual void measureExample();
+
+    virtual ~SoftmaxClassMeasurer();
+};
+
+}
+
+#endif  // TORCH_SOFTMAX_CLASS_MEASURER_H_
@@ -0,0 +1,47 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "softmax_class_nll_measurer.h"
+
+namespace Torch {
+
+SoftmaxClassNLLMeasurer::SoftmaxClassNLLMeasurer(Sequence *inputs_, DataSet *data_, ClassFormat *class_format_,
+                                                 XFile *file_, SoftmaxNLLCriterion *criterion_)
+    : ClassNLLMeasurer(inputs_, data_, class_format_, file_)
+{
+  criterion = criterion_;
+}
+
+// Same as ClassNLLMeasurer::measureExample, with the cached NLLs.
+void SoftmaxClassNLLMeasurer::measureExample()
+{
+  if(!criterion->IsCached(data))        {
+    ClassNLLMeasurer::measureExample();
+    return;
+  }
+
+  real sum = 0.;
+  for(int i = 0; i < inputs->n_frames; i++)
+    sum += criterion->nlls[i];
+
+  if(average_frames)
+    sum /= inputs->n_frames;
+  internal_error += sum;
+}
+
+SoftmaxClassNLLMeasurer::~SoftmaxClassNLLMeasurer()
+{
+}
+
+}
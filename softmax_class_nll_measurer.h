@@ -0,0 +1,41 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_SOFTMAX_CLASS_NLL_MEASURER_H_
+#define TORCH_SOFTMAX_CLASS_NLL_MEASURER_H_
+
+#include "ClassNLLMeasurer.h"
+#include "softmax_nll_criterion.h"
+
+namespace Torch {
+
+// A ClassNLLMeasurer that takes the NLL from the cache of a
+// SoftmaxNLLCriterion when it holds the current example.
+//
+class SoftmaxClassNLLMeasurer : public ClassNLLMeasurer
+{
+  public:
+    SoftmaxNLLCriterion *criterion;
+
+    SoftmaxClassNLLMeasurer(Sequence *inputs_, DataSet *data_, ClassFormat *class_format_, XFile *file_,
+                            SoftmaxNLLCriterion *criterion_);
+
+    virtual void measureExample();
+
+    virtual ~SoftmaxClassNLLMeasurer();
+};
+
+}
+
+#endif  // TORCH_SOFTMAX_CLASS_NLL_MEASURER_H_
@@ -0,0 +1,75 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#include "softmax_nll_criterion.h"
+#include "coder.h"
+
+namespace Torch {
+
+SoftmaxNLLCriterion::SoftmaxNLLCriterion(ClassFormat *class_format_, Coder *coder_)
+    : Criterion(class_format_->getOutputSize())
+{
+  class_format = class_format_;
+  coder = coder_;
+  if(coder->nonlinearity != "logsoftmax")
+    error("SoftmaxNLLCriterion - the coder's nonlinearity must be logsoftmax!");
+  coder->setAlphaOnPreActivations(true);
+
+  cached_forward = -1;
+  n_cached_frames = 0;
+  target_classes = NULL;
+  predicted_classes = NULL;
+  nlls = NULL;
+}
+
+bool SoftmaxNLLCriterion::IsCached(DataSet *data_)
+{
+  return (data_ == data) && (cached_forward == coder->n_forwards);
+}
+
+void SoftmaxNLLCriterion::forward(Sequence *inputs)
+{
+  if(inputs->n_frames > n_cached_frames)        {
+    n_cached_frames = inputs->n_frames;
+    target_classes = (int*)allocator->realloc(target_classes, sizeof(int)*n_cached_frames);
+    predicted_classes = (int*)allocator->realloc(predicted_classes, sizeof(int)*n_cached_frames);
+    nlls = (real*)allocator->realloc(nlls, sizeof(real)*n_cached_frames);
+  }
+
+  Criterion::forward(inputs);
+  cached_forward = coder->n_forwards;
+}
+
+void SoftmaxNLLCriterion::frameForward(int t, real *f_inputs, real *f_outputs)
+{
+  target_classes[t] = class_format->getClass(data->targets->frames[t]);
+  predicted_classes[t] = class_format->getClass(f_inputs);
+  nlls[t] = -f_inputs[target_classes[t]];
+
+  f_outputs[0] = nlls[t];
+}
+
+// The inputs are log-probabilities: their exponential is the softmax.
+void SoftmaxNLLCriterion::frameBackward(int t, real *f_inputs, real *beta_, real *f_outputs, real *alpha_)
+{
+  for(int i = 0; i < n_inputs; i++)
+    beta_[i] = exp(f_inputs[i]);
+  beta_[target_classes[t]] -= 1.;
+}
+
+SoftmaxNLLCriterion::~SoftmaxNLLCriterion()
+{
+}
+
+}
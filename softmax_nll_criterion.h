@@ -0,0 +1,71 @@
+// Copyright 2008 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef TORCH_SOFTMAX_NLL_CRITERION_H_
+#define TORCH_SOFTMAX_NLL_CRITERION_H_
+
+#include "Criterion.h"
+#include "ClassFormat.h"
+
+namespace Torch {
+
+class Coder;
+
+// Negative log likelihood criterion fused with the softmax of a "logsoftmax"
+// Coder, such as the outputer of a StackedAutoencoder.
+//
+// Its inputs are the log-probabilities computed by the coder, whose
+// normalizer is thus computed once. Its beta is the derivative with respect
+// to the pre-activations, softmax - onehot: the coder is set to skip the
+// backward of its LogSoftMax (see Coder::setAlphaOnPreActivations).
+//
+// The forward caches, for each frame, the class of the target, the predicted
+// class and the NLL, so that the classification measurers of the training set
+// don't compute them again (see SoftmaxClassMeasurer and
+// SoftmaxClassNLLMeasurer).
+//
+class SoftmaxNLLCriterion : public Criterion
+{
+  public:
+    ClassFormat *class_format;
+    Coder *coder;
+
+    // The cache, valid for the outputs of the coder's forward number
+    // cached_forward (-1 if none).
+    int cached_forward;
+    int n_cached_frames;
+    int *target_classes;
+    int *predicted_classes;
+    real *nlls;
+
+
+    SoftmaxNLLCriterion(ClassFormat *class_format_, Coder *coder_);
+
+    // True if the cache is about the current outputs of the coder and the
+    // current example of #data_#.
+    virtual bool IsCached(DataSet *data_);
+
+    //-----
+
+    virtual void forward(Sequence *inputs);
+    virtual void frameForward(int t, real *f_inputs, real *f_outputs);
+    virtual void frameBackward(int t, real *f_inputs, real *beta_, real *f_outputs, real *alpha_);
+
+    virtual ~SoftmaxNLLCriterion();
+};
+
+}
+
+
+#endif  // TORCH_SOFTMAX_NLL_CRITERION_H_
@@ -17,6 +17,7 @@
 #include "identity.h"
 #include "destructive.h"
 #include "smoothed_linear.h"
+#include "parameter_arena.h"
 
 namespace Torch {
 
@@ -29,7 +30,8 @@ StackedAutoencoder::StackedAutoencoder(std::string name_,
                                        int *n_units_per_hidden_layer_,
                                        int n_outputs_,
                                        bool is_noisy_,
-                                       bool first_layer_smoothed_)
+                                       bool first_layer_smoothed_,
+                                       StackedAutoencoder *params_owner_)
 {
   name = name_;
   is_noisy = is_noisy_;
@@ -37,6 +39,7 @@ StackedAutoencoder::StackedAutoencoder(std::string name_,
   reparametrize_tied = reparametrize_tied_;
   nonlinearity = nonlinearity_;
   first_layer_smoothed = first_layer_smoothed_;
+  params_owner = params_owner_;
 
   // the topology
   n_hidden_layers = n_hidden_layers_;
@@ -53,7 +56,7 @@ StackedAutoencoder::StackedAutoencoder(std::string name_,
   n_units_per_layer[n_hidden_layers+1] = n_outputs_;
 
   //
-  input_handle_machine = new(allocator)Identity(n_units_per_layer[0]);
+  input_handle_machine = new(allocator)Identity(n_units_per_layer[0], true);
   BuildCoders();
 
   //
@@ -64,6 +67,11 @@ StackedAutoencoder::StackedAutoencoder(std::string name_,
   BuildSupMachine();
   BuildUnsupMachine();
   BuildSupUnsupMachine();
+
+  arena = NULL;
+  arena_coders = NULL;
+  n_arena_coders = 0;
+  PackParameters();
 }
 
 void StackedAutoencoder::BuildCoders()
@@ -73,10 +81,12 @@ void StackedAutoencoder::BuildCoders()
   for(int i=0; i<n_hidden_layers; i++) {
     if (i==0  && first_layer_smoothed) {
       encoders[i] = new(allocator) Coder(n_units_per_layer[i], n_units_per_layer[i+1],
-                                       false, NULL, false, false, nonlinearity, true);
+                                       false, NULL, false, false, nonlinearity, true,
+                                       (params_owner ? params_owner->encoders[i] : NULL));
     } else  {
       encoders[i] = new(allocator) Coder(n_units_per_layer[i], n_units_per_layer[i+1],
-                                       false, NULL, false, false, nonlinearity, false);
+                                       false, NULL, false, false, nonlinearity, false,
+                                       (params_owner ? params_owner->encoders[i] : NULL));
     }
   }
 
@@ -100,17 +110,20 @@ void StackedAutoencoder::BuildCoders()
     // decoder
     if(tied_weights)  {
       decoders[i] = new(allocator) Coder(encoders[i]->n_outputs, encoders[i]->n_inputs,
-                                         false, encoders[i], true, reparametrize_tied, nonlinearity);
+                                         false, encoders[i], true, reparametrize_tied, nonlinearity,
+                                         false, (params_owner ? params_owner->decoders[i] : NULL));
     } else    {
       decoders[i] = new(allocator) Coder(encoders[i]->n_outputs, encoders[i]->n_inputs,
-                                         false, NULL, false, false, nonlinearity);
+                                         false, NULL, false, false, nonlinearity,
+                                         false, (params_owner ? params_owner->decoders[i] : NULL));
     }
   }
 
   // Outputer
   outputer = new(allocator) Coder(n_units_per_layer[n_hidden_layers],
                                   n_units_per_layer[n_hidden_layers+1],
-                                  false, NULL, false, false, "logsoftmax");
+                                  false, NULL, false, false, "logsoftmax",
+                                  false, (params_owner ? params_owner->outputer : NULL));
 
 
 }
@@ -288,14 +301,14 @@ void StackedAutoencoder::BuildSupUnsupMachine()
 void StackedAutoencoder::setL1WeightDecay(real weight_decay)
 {
   for(int i=0; i<n_hidden_layers; i++) {
-    encoders[i]->linear_layer->setROption("l1 weight decay", weight_decay);
+    encoders[i]->setL1WeightDecay(weight_decay);
   }
 
-  outputer->linear_layer->setROption("l1 weight decay", weight_decay);
+  outputer->setL1WeightDecay(weight_decay);
 
   if(!tied_weights)     {
     for(int i=0; i<n_hidden_layers; i++) {
-      decoders[i]->linear_layer->setROption("l1 weight decay", weight_decay);
+      decoders[i]->setL1WeightDecay(weight_decay);
     }
   }
 }
@@ -305,14 +318,14 @@ void StackedAutoencoder::setL1WeightDecay(real weight_decay)
 void StackedAutoencoder::setL2WeightDecay(real weight_decay)
 {
   for(int i=0; i<n_hidden_layers; i++) {
-    encoders[i]->linear_layer->setROption("weight decay", weight_decay);
+    encoders[i]->setL2WeightDecay(weight_decay);
   }
 
-  outputer->linear_layer->setROption("weight decay", weight_decay);
+  outputer->setL2WeightDecay(weight_decay);
 
   if(!tied_weights)     {
     for(int i=0; i<n_hidden_layers; i++) {
-      decoders[i]->linear_layer->setROption("weight decay", weight_decay);
+      decoders[i]->setL2WeightDecay(weight_decay);
     }
   }
 }
@@ -321,7 +334,7 @@ void StackedAutoencoder::setL2WeightDecay(real weight_decay)
 void StackedAutoencoder::setBiasDecay(real bias_decay)
 {
   for(int i=0; i<n_hidden_layers; i++) {
-    encoders[i]->linear_layer->setROption("bias decay", bias_decay);
+    encoders[i]->setBiasDecay(bias_decay);
   }
 
 }
@@ -345,6 +358,178 @@ void StackedAutoencoder::setSmoothingDecay(real l1_smoothing_decay, real l2_smoo
   }
 }
 
+void StackedAutoencoder::setSmoothingImageSize(int width, int height)
+{
+  if (first_layer_smoothed) {
+    SmoothedLinear *sl = (SmoothedLinear*) encoders[0]->linear_layer;
+    sl->setIOption("input width", width);
+    sl->setIOption("input height", height);
+  }
+}
+
+// Only when the first encoder was backpropagated for this update: otherwise it
+// is not being trained, and its der_params are left untouched.
+void StackedAutoencoder::AddSmoothingGradient(real n_examples)
+{
+  if (first_layer_smoothed && encoders[0]->backpropagated) {
+    SmoothedLinear *sl = (SmoothedLinear*) encoders[0]->linear_layer;
+    sl->AddSmoothingGradient(n_examples);
+    encoders[0]->derivatives_touched = true;
+  }
+}
+
+// The tied decoders only decay their bias: their weights are caught up
+// through the encoder that owns them.
+void StackedAutoencoder::ApplyWeightDecay(Parameters *updated_params, real learning_rate)
+{
+  for(int i=0; i<n_hidden_layers; i++) {
+    encoders[i]->ApplyWeightDecay(updated_params, learning_rate);
+    decoders[i]->ApplyWeightDecay(updated_params, learning_rate);
+  }
+  outputer->ApplyWeightDecay(updated_params, learning_rate);
+}
+
+void StackedAutoencoder::FlushWeightDecay()
+{
+  for(int i=0; i<n_hidden_layers; i++) {
+    encoders[i]->FlushWeightDecay();
+    if(!tied_weights)
+      decoders[i]->FlushWeightDecay();
+  }
+  outputer->FlushWeightDecay();
+}
+
+void StackedAutoencoder::PackParameters()
+{
+  ParameterArena *new_arena = new(allocator) ParameterArena();
+  n_arena_coders = 0;
+  AddArenaLayers(new_arena);
+  new_arena->Pack();
+  RemapParameters(new_arena);
+  new_arena->ReleaseOldArrays();
+
+  if(arena)
+    allocator->free(arena);
+  arena = new_arena;
+}
+
+void StackedAutoencoder::AddCoderLayer(ParameterArena *new_arena, Coder *coder)
+{
+  new_arena->AddLayer(coder->linear_layer, !coder->params_owner);
+  arena_coders = (Coder**)allocator->realloc(arena_coders, sizeof(Coder*)*(n_arena_coders+1));
+  arena_coders[n_arena_coders++] = coder;
+}
+
+static void RemapCoder(ParameterArena *new_arena, Coder *coder)
+{
+  new_arena->Remap(coder->params);
+  new_arena->Remap(coder->der_params);
+}
+
+static void RemapMachine(ParameterArena *new_arena, GradientMachine *machine)
+{
+  new_arena->Remap(machine->params);
+  new_arena->Remap(machine->der_params);
+}
+
+void StackedAutoencoder::AddArenaLayers(ParameterArena *new_arena)
+{
+  for(int i=0; i<n_hidden_layers; i++)
+    AddCoderLayer(new_arena, encoders[i]);
+  AddCoderLayer(new_arena, outputer);
+  for(int i=0; i<n_hidden_layers; i++)  {
+    AddCoderLayer(new_arena, decoders[i]);
+    if(is_noisy)
+      AddCoderLayer(new_arena, noisy_encoders[i]);
+  }
+}
+
+void StackedAutoencoder::RemapParameters(ParameterArena *new_arena)
+{
+  for(int i=0; i<n_hidden_layers; i++)  {
+    RemapCoder(new_arena, encoders[i]);
+    RemapCoder(new_arena, decoders[i]);
+    if(is_noisy)
+      RemapCoder(new_arena, noisy_encoders[i]);
+    RemapMachine(new_arena, autoencoders[i]);
+    RemapMachine(new_arena, mesd_machines[i]);
+  }
+  RemapCoder(new_arena, outputer);
+
+  RemapMachine(new_arena, this);
+  RemapMachine(new_arena, unsup_machine);
+  RemapMachine(new_arena, sup_unsup_machine);
+}
+
+// The coder whose linear layer has #der_array# among its derivatives, or NULL.
+static Coder *FindArrayCoder(Coder **coders, int n_coders, real *der_array)
+{
+  for(int c=0; c<n_coders; c++) {
+    Parameters *der_params = coders[c]->linear_layer->der_params;
+    for(int k=0; k<der_params->n_data; k++)   {
+      if(der_params->data[k] == der_array)
+        return coders[c];
+    }
+  }
+  return NULL;
+}
+
+void StackedAutoencoder::FindTouchedArrays(Parameters *der_params, bool *touched)
+{
+  for(int i=0; i<der_params->n_data; i++)  {
+    Coder *coder = FindArrayCoder(arena_coders, n_arena_coders, der_params->data[i]);
+    if(coder && !coder->derivatives_touched)
+      touched[i] = false;
+  }
+}
+
+void StackedAutoencoder::SetTouched(Parameters *der_params, bool touched)
+{
+  for(int i=0; i<der_params->n_data; i++)  {
+    Coder *coder = FindArrayCoder(arena_coders, n_arena_coders, der_params->data[i]);
+    if(coder)
+      coder->derivatives_touched = touched;
+  }
+}
+
+StackedAutoencoder *StackedAutoencoder::NewExecutionContext()
+{
+  StackedAutoencoder *context = new(allocator) StackedAutoencoder(name, nonlinearity, tied_weights,
+                                                                  reparametrize_tied,
+                                                                  n_units_per_layer[0],
+                                                                  n_hidden_layers,
+                                                                  &n_units_per_layer[1],
+                                                                  n_units_per_layer[n_hidden_layers+1],
+                                                                  is_noisy, first_layer_smoothed,
+                                                                  this);
+  context->CopySettings(this);
+  return context;
+}
+
+StackedAutoencoder *StackedAutoencoder::NewCopy()
+{
+  StackedAutoencoder *copy = new(allocator) StackedAutoencoder(name, nonlinearity, tied_weights,
+                                                               reparametrize_tied,
+                                                               n_units_per_layer[0],
+                                                               n_hidden_layers,
+                                                               &n_units_per_layer[1],
+                                                               n_units_per_layer[n_hidden_layers+1],
+                                                               is_noisy, first_layer_smoothed);
+  copy->CopySettings(this);
+  return copy;
+}
+
+void StackedAutoencoder::CopySettings(StackedAutoencoder *from)
+{
+  for(int i=0; i<n_hidden_layers; i++) {
+    encoders[i]->CopySettings(from->encoders[i]);
+    decoders[i]->CopySettings(from->decoders[i]);
+    if(is_noisy)
+      noisy_encoders[i]->CopySettings(from->noisy_encoders[i]);
+  }
+  outputer->CopySettings(from->outputer);
+}
+
 void StackedAutoencoder::loadXFile(XFile *file)
 {
   sup_unsup_machine->loadXFile(file);
@@ -352,6 +537,7 @@ void StackedAutoencoder::loadXFile(XFile *file)
 
 void StackedAutoencoder::saveXFile(XFile *file)
 {
+  FlushWeightDecay();
   sup_unsup_machine->saveXFile(file);
 }
 
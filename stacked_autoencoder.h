@@ -22,6 +22,7 @@
 namespace Torch {
 
 class Identity;
+class ParameterArena;
 //class Linear;
 //class Destructive;
 //class Nonlinear;
@@ -80,6 +81,20 @@ class StackedAutoencoder : public ConnectedMachine
                                                 // the resonstructed units
                                                 // y, \hat{x}, \hat{h1}, \hat{h2}, ...
 
+    // If not NULL, this is an execution context of params_owner: the same
+    // graph of machines, with its own activations, betas, corruption masks
+    // and derivatives, over the parameters of params_owner (see
+    // Coder::params_owner). Each thread can run its own context.
+    StackedAutoencoder *params_owner;
+
+    // All the parameters and derivatives of the coders, in one block each
+    // (see ParameterArena). The encoders and the outputer come first, so the
+    // parameters of the supervised machine are one run.
+    ParameterArena *arena;
+    // The coders whose linear layers are in the arena.
+    Coder **arena_coders;
+    int n_arena_coders;
+
     StackedAutoencoder(std::string name_,
                        std::string nonlinearity_,
                        bool tied_weights_,
@@ -89,7 +104,8 @@ class StackedAutoencoder : public ConnectedMachine
                        int *n_hidden_units_per_layer_,
                        int n_outputs_,
                        bool is_noisy_,
-                       bool first_layer_smoothed_);
+                       bool first_layer_smoothed_,
+                       StackedAutoencoder *params_owner_=NULL);
 
     //
     virtual void AddCoreMachines(ConnectedMachine* mch);
@@ -108,6 +124,40 @@ class StackedAutoencoder : public ConnectedMachine
     virtual void setBiasDecay(real bias_decay);
     virtual void setDestructionOptions(real destruct_prob, real destruct_value);
     virtual void setSmoothingDecay(real l1_smoothing_decay, real l2_smoothing_decay);
+    virtual void setSmoothingImageSize(int width, int height);
+    // Adds the gradient of the smoothing decay for #n_examples# examples, if
+    // the first encoder was backpropagated. To be called by the trainers
+    // before each update.
+    virtual void AddSmoothingGradient(real n_examples);
+    // The lazy weight decays of the coders, see Coder::ApplyWeightDecay.
+    virtual void ApplyWeightDecay(Parameters *updated_params, real learning_rate);
+    virtual void FlushWeightDecay();
+
+    // Moves the parameters and derivatives of the coders into a new arena,
+    // and remaps all the machines built on them. Called by the constructors.
+    virtual void PackParameters();
+    virtual void AddArenaLayers(ParameterArena *new_arena);
+    // Adds the linear layer of #coder# to #new_arena#. An execution context
+    // only moves its derivatives: its parameters are the owner's.
+    virtual void AddCoderLayer(ParameterArena *new_arena, Coder *coder);
+    virtual void RemapParameters(ParameterArena *new_arena);
+
+    // Clears touched[i] for the arrays of #der_params# that belong to a coder
+    // of this machine whose derivatives were not touched since they were
+    // last cleared. The other entries are left alone.
+    virtual void FindTouchedArrays(Parameters *der_params, bool *touched);
+    // Sets the touched flag of the coders owning arrays of #der_params#.
+    virtual void SetTouched(Parameters *der_params, bool touched);
+
+    // A new execution context over the parameters of this machine, with its
+    // settings (decays, corruption, smoothing). Set them first.
+    virtual StackedAutoencoder *NewExecutionContext();
+    // A new machine of the same architecture and settings, with its own
+    // parameters (not copied), e.g. for the replicas of an asynchronous
+    // evaluation (see StochasticGradientPlus).
+    virtual StackedAutoencoder *NewCopy();
+    // Takes the settings of the coders of #from#.
+    virtual void CopySettings(StackedAutoencoder *from);
 
     // Saves-loads the parameters. Currently the rest of the save is in
     // helpers (the topology).
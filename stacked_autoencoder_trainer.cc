@@ -28,10 +28,14 @@
 #include "DiskXFile.h"
 #include "input_as_target_data_set.h"
 #include "dynamic_data_set.h"
+#include "cached_data_set.h"
+#include "shared_data_set.h"
+#include "gradient_statistics.h"
 #include "cross_entropy_criterion.h"
 
 #include "concat_criterion.h"
 #include "stacked_autoencoder.h"
+#include "parameter_arena.h"
 #include "cross_entropy_measurer.h"
 #include "fake_data_measurer.h"
 
@@ -56,13 +60,20 @@ StackedAutoencoderTrainer::StackedAutoencoderTrainer(StackedAutoencoder *machine
   unsup_datasets = NULL;
   unsup_criterions = NULL;
   unsup_measurers = NULL;
+  concat_criterion = NULL;
 
   criterions_weights = (real*) allocator->alloc(sizeof(real)*(sae->n_hidden_layers+1));
   finetuning_learning_rates  = (real*) allocator->alloc(sizeof(real)*(sae->n_hidden_layers+1));
+  criterion_gradient_stats = (GradientStatistics**) allocator->alloc(sizeof(GradientStatistics*)*(sae->n_hidden_layers+1));
   for (int i = 0; i < sae->n_hidden_layers + 1; i++)  {
     criterions_weights[i] = 0.0;
     finetuning_learning_rates[i] = 0.0;
+    criterion_gradient_stats[i] = new(allocator) GradientStatistics();
   }
+  addBOption("sample criterion weights", &sample_criterion_weights, false,
+             "estimate the criterion weights on samples at each epoch instead of online (always with tied weights)");
+  addIOption("criterion weight samples", &n_criterion_weight_samples, 1000,
+             "number of examples sampled per criterion for the criterion weights");
 
   layerwise_training = false;
   layerwise_layer = 0;
@@ -70,6 +81,16 @@ StackedAutoencoderTrainer::StackedAutoencoderTrainer(StackedAutoencoder *machine
   topKlayers = 0;
 
   is_finetuning = false;
+
+  layer_cache = NULL;
+  addBOption("cache lower layers", &cache_lower_layers, false,
+             "in layerwise pretraining, train each autoencoder on stored outputs of the layer below");
+  addBOption("cache frozen layers", &cache_frozen_layers, false,
+             "when training the top layers, store the outputs of the frozen ones once");
+  addBOption("half precision cache", &half_precision_cache, false,
+             "store the outputs of the frozen layers as half floats");
+  addBOption("parallel evaluation", &parallel_evaluation, false,
+             "with threads, forward the measured DataSets on the replicas' execution contexts");
  
   // Gradient profiling
   profile_gradients = false;
@@ -82,14 +103,38 @@ StackedAutoencoderTrainer::StackedAutoencoderTrainer(StackedAutoencoder *machine
   sup_saved_grads = NULL;
   unsup_saved_grads = NULL;
   saved_grads = NULL;
+  sup_betas = NULL;
 
   gradient_angle_measurers = NULL;
 }
 
 
-real StackedAutoencoderTrainer::EvalHessian(GradientMachine *the_gm, Criterion* the_criterion, DataSet *the_data, int n_samples)
+GradientMachine *StackedAutoencoderTrainer::WeighedMachine(int c)
+{
+  if(c == 0)
+    return sae;
+  return sae->mesd_machines[c-1];
+}
+
+Criterion *StackedAutoencoderTrainer::WeighedCriterion(int c)
+{
+  if(c == 0)
+    return sup_criterion;
+  return unsup_criterions[c-1];
+}
+
+DataSet *StackedAutoencoderTrainer::WeighedData(int c)
+{
+  if(c == 0)
+    return sup_dataset;
+  return unsup_datasets[c-1];
+}
+
+void StackedAutoencoderTrainer::SampleCriterionGradients(int c, DataSet *the_data, int begin, int end)
 {
-  assert(n_samples<=the_data->n_examples);
+  GradientMachine *the_gm = WeighedMachine(c);
+  Criterion *the_criterion = WeighedCriterion(c);
+  assert(end<=the_data->n_examples);
   assert(the_gm && the_criterion && the_data);
 
   the_gm->setDataSet(the_data);
@@ -100,35 +145,7 @@ real StackedAutoencoderTrainer::EvalHessian(GradientMachine *the_gm, Criterion*
   the_gm->iterInitialize();
   the_criterion->iterInitialize();
 
-  Parameters *der_params = the_gm->der_params;
-  assert(der_params);
-
-  // allocate
-  int n_parameters = 0;
-  for(int i=0; i<der_params->n_data; i++)
-    n_parameters += der_params->size[i];
-
-  message("*** %d parameters!", n_parameters);
-
-  real *grad_sumX;
-  real *grad_sumX2;
-  real *grad_means;
-  real *grad_variances;
-
-  grad_sumX = (real*) allocator->alloc(sizeof(real)*n_parameters);
-  memset(grad_sumX, 0, sizeof(real)*n_parameters);
-
-  grad_sumX2 = (real*) allocator->alloc(sizeof(real)*n_parameters);
-  memset(grad_sumX2, 0, sizeof(real)*n_parameters);
-
-  grad_means = (real*) allocator->alloc(sizeof(real)*n_parameters);
-  memset(grad_means, 0, sizeof(real)*n_parameters);
-
-  grad_variances = (real*) allocator->alloc(sizeof(real)*n_parameters);
-  memset(grad_variances, 0, sizeof(real)*n_parameters);
-
-
-  for(int i=0; i<n_samples; i++)        {
+  for(int i=begin; i<end; i++)        {
     ClearDerivatives(the_gm);
 
     the_data->setExample(i);
@@ -139,50 +156,104 @@ real StackedAutoencoderTrainer::EvalHessian(GradientMachine *the_gm, Criterion*
     the_criterion->backward(the_gm->outputs, NULL);
     the_gm->backward(the_data->inputs, the_criterion->beta);
 
-    // measure
-    int index = 0;
-    for(int j=0; j<der_params->n_data; j++)     {
-      for(int k=0; k<der_params->size[j]; k++)  {
-        if(fabs(der_params->data[j][k])>10.0)
-          std::cout << "Param group " << j << " of size "<< der_params->size[j] << ". "
-               << "Param " << k << " has gradient " << der_params->data[j][k] << std::endl;
-        grad_sumX[index] += der_params->data[j][k];
-        grad_sumX2[index] += der_params->data[j][k] * der_params->data[j][k];
-        index++;
-      }
+    criterion_gradient_stats[c]->Add(the_gm->der_params);
+  }
+
+  // The training may have marked these derivatives as cleared.
+  ClearDerivatives(the_gm);
+}
+
+void StackedAutoencoderTrainer::SampleCriterionsGradients(int n_samples)
+{
+  bool threaded = (n_threads > 1);
+  if(threaded && n_replicas < n_threads)
+    error("StackedAutoencoderTrainer: %d threads need as many replicas (%d given)", n_threads, n_replicas);
+
+  for(int c=0; c<=sae->n_hidden_layers; c++)    {
+    if(!threaded)       {
+      SampleCriterionGradients(c, WeighedData(c), 0, n_samples);
+      continue;
+    }
+
+    // Each replica samples a contiguous part of the examples, on its own
+    // view of the data.
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(n_threads) schedule(static, 1)
+#endif
+    for(int r=0; r<n_threads; r++)      {
+      StackedAutoencoderTrainer *replica = (StackedAutoencoderTrainer*)replicas[r];
+      DataSet *replica_data = (c == 0 ? replica_datas[r] : replica->unsup_datasets[c-1]);
+      int begin = (int)(((long)n_samples*r)/n_threads);
+      int end = (int)(((long)n_samples*(r+1))/n_threads);
+      replica->SampleCriterionGradients(c, replica_data, begin, end);
+    }
+
+    for(int r=0; r<n_threads; r++)      {
+      StackedAutoencoderTrainer *replica = (StackedAutoencoderTrainer*)replicas[r];
+      criterion_gradient_stats[c]->Merge(replica->criterion_gradient_stats[c]);
+      replica->criterion_gradient_stats[c]->Reset();
     }
   }
+}
+
+// A tied decoder's der_params only hold its bias, which says little of the
+// criterion next to the whole outputer.
+bool StackedAutoencoderTrainer::SamplesCriterionWeights()
+{
+  return sample_criterion_weights || sae->tied_weights;
+}
+
+// Only when training the sup_unsup_machine with its concatenation of the
+// criterions, whose weights scale the gradients.
+void StackedAutoencoderTrainer::AddTrainingCriterionGradients(int n_examples)
+{
+  if(!do_eval_criterion_weights || SamplesCriterionWeights() || n_examples < 1)
+    return;
+  if(!concat_criterion || criterion != concat_criterion || machine != sae->sup_unsup_machine)
+    return;
+
+  real *weights = concat_criterion->criterion_weights;
+  for(int c=0; c<=sae->n_hidden_layers; c++)    {
+    real weight = (weights ? weights[c] : 1.);
+    if(weight == 0.)
+      continue;
+    GradientMachine *top = (c == 0 ? (GradientMachine*)sae->outputer : (GradientMachine*)sae->decoders[c-1]);
+    criterion_gradient_stats[c]->Add(top->der_params, 1./(weight*(real)n_examples), n_examples);
+  }
+}
 
-  // find the max and print out
-  real max_sumX=0.0;
-  real max_sumX2=0.0;
-  real max_means=0.0;
-  real max_variance = 0.0;
-
-  for(int i=0; i<n_parameters; i++)     {
-    grad_means[i] = grad_sumX[i] / (real)n_samples;
-    grad_variances[i] = grad_sumX2[i] / (real)n_samples - grad_means[i] * grad_means[i];
-    if(max_variance < grad_variances[i])        {
-      max_sumX = grad_sumX[i];
-      max_sumX2 = grad_sumX2[i];
-      max_means = grad_means[i];
-      max_variance = grad_variances[i];
+void StackedAutoencoderTrainer::EvalCriterionWeights()
+{
+  if(SamplesCriterionWeights())
+    SampleCriterionsGradients(n_criterion_weight_samples);
+  else  {
+    // The replicas' statistics, if the training was threaded.
+    for(int r=0; r<n_replicas; r++)     {
+      StackedAutoencoderTrainer *replica = (StackedAutoencoderTrainer*)replicas[r];
+      for(int c=0; c<=sae->n_hidden_layers; c++)        {
+        criterion_gradient_stats[c]->Merge(replica->criterion_gradient_stats[c]);
+        replica->criterion_gradient_stats[c]->Reset();
+      }
     }
   }
 
-  message("max sumX: %f, max sumX2: %f, max means: %f, MAX VARIANCE: %f -> weight propto %f",
-          (float) max_sumX,
-          (float) max_sumX2,
-          (float) max_means,
-          (float) max_variance,
-          (float) 1.0/max_variance);
+  real sup_variance = criterion_gradient_stats[0]->MaxVariance();
+  message("supervised criterion: max variance %f over %d samples",
+          (float)sup_variance, criterion_gradient_stats[0]->n_samples);
 
-  allocator->free(grad_sumX);
-  allocator->free(grad_sumX2);
-  allocator->free(grad_means);
-  allocator->free(grad_variances);
+  // A weight without statistics is kept.
+  std::cout << "weights: 1.0 ";
+  for(int i=0; i<sae->n_hidden_layers; i++)     {
+    real variance = criterion_gradient_stats[1+i]->MaxVariance();
+    if(sup_variance > 0. && variance > 0.)
+      criterions_weights[1+i] = sqrt(sup_variance / variance);
+    std::cout << criterions_weights[1+i] << " ";
+  }
+  criterions_weights[0] = 1.0;
+  std::cout << std::endl << std::endl;
 
-  return 1.0/max_variance;
+  for(int c=0; c<=sae->n_hidden_layers; c++)
+    criterion_gradient_stats[c]->Reset();
 }
 
 void StackedAutoencoderTrainer::ClearSequence(Sequence *seq)
@@ -194,7 +265,8 @@ void StackedAutoencoderTrainer::ClearSequence(Sequence *seq)
 
 void StackedAutoencoderTrainer::TrainInitialize()
 {
-
+  if(profile_gradients && n_threads > 1)
+    error("StackedAutoencoderTrainer - gradient profiling can't be threaded.");
 }
 
 void StackedAutoencoderTrainer::TrainFinalize()
@@ -205,23 +277,10 @@ void StackedAutoencoderTrainer::TrainFinalize()
 
 void StackedAutoencoderTrainer::IterInitialize()
 {
-  // *** Evaluation of the Hessian
-  if(do_eval_criterion_weights && epoch) {
-    // Eval Hessian!
-    criterions_weights[0] = EvalHessian(sae, sup_criterion, sup_dataset, 1000);
-
-    for(int i=0; i<sae->n_hidden_layers; i++)
-      criterions_weights[1+i] = EvalHessian(sae->mesd_machines[i], unsup_criterions[i], unsup_datasets[i], 1000);
-
-    std::cout << "weights: 1.0 ";
-    for(int i=0; i<sae->n_hidden_layers; i++)     {
-      criterions_weights[1+i] /= criterions_weights[0];
-      criterions_weights[1+i] = sqrt(criterions_weights[1+i]);
-      std::cout << criterions_weights[1+i] << " ";
-    }
-    criterions_weights[0] = 1.0;
-    std::cout << std::endl << std::endl;
-  }
+  // *** Evaluation of the criterion weights, from the gradients of the
+  // previous epoch or on samples
+  if(do_eval_criterion_weights && epoch)
+    EvalCriterionWeights();
 
 /*  warning("Forcing some criterion weights to zero");
   for(int i=1; i<sae->n_hidden_layers; i++)     {
@@ -286,24 +345,271 @@ void StackedAutoencoderTrainer::fpropbprop(DataSet *data)
   }
 }
 
+// The smoothing gradient is only added if the first layer was backpropagated
+// since the last update (see StackedAutoencoder::AddSmoothingGradient), so it
+// must come before the update, which resets that. The criterion statistics
+// are taken before, on the gradients of the costs alone.
+void StackedAutoencoderTrainer::PrepareUpdate(int n_examples)
+{
+  AddTrainingCriterionGradients(n_examples);
+  sae->AddSmoothingGradient((real)n_examples);
+  StochasticGradientPlus::PrepareUpdate(n_examples);
+}
+
+// The state of the optimizer is laid out like the arena of the sae.
+void StackedAutoencoderTrainer::PrepareOptimizer(GradientMachine *gm)
+{
+  optimizer->AddBlock(sae->arena->params, sae->arena->n_reals);
+  StochasticGradientPlus::PrepareOptimizer(gm);
+}
+
 void StackedAutoencoderTrainer::UpdateMachine(GradientMachine *gm, real current_learning_rate)
 {
   if (!is_finetuning)
     StochasticGradientPlus::UpdateMachine(gm, current_learning_rate);
   // We are fine-tuning. The machine is the sae and we want to apply a specific
   // learning rate to each layer.
+  // The layer specific learning rates are averaged over the minibatch like
+  // the global one, and scale the step of the optimizer for their layer.
   else  {
     assert(gm == sae);
 
-    for (int i=0; i<sae->n_hidden_layers; i++)  {
-      if (finetuning_learning_rates[i] > 0.)
-        StochasticGradientPlus::UpdateMachine(sae->encoders[i], finetuning_learning_rates[i]);
+    real batch_norm = 1.0 / (real)(n_accumulated_examples>0 ? n_accumulated_examples : 1);
+    bool clear = FuseClearWithUpdate();
+    bool all_cleared = clear;
+    for (int i=0; i<=sae->n_hidden_layers; i++)  {
+      GradientMachine *layer = (i<sae->n_hidden_layers ? (GradientMachine*)sae->encoders[i] : (GradientMachine*)sae->outputer);
+      if (finetuning_learning_rates[i] > 0.)  {
+        UpdateParameters(layer, batch_norm*finetuning_learning_rates[i], clear);
+        ApplyWeightDecay(layer, batch_norm*finetuning_learning_rates[i]*(real)n_accumulated_examples);
+      }
+      else
+        all_cleared = false;
+    }
+    // The sae's der_params are those of its layers.
+    if (all_cleared)
+      MarkDerivativesCleared(sae);
+  }
+}
+
+void StackedAutoencoderTrainer::FindTouchedArrays(Parameters *der_params, bool *touched)
+{
+  sae->FindTouchedArrays(der_params, touched);
+}
+
+void StackedAutoencoderTrainer::SetTouched(Parameters *der_params, bool touched)
+{
+  sae->SetTouched(der_params, touched);
+}
+
+// Through UpdateMachine, so in fine-tuning each layer gets the decay of its
+// own learning rate.
+void StackedAutoencoderTrainer::ApplyWeightDecay(GradientMachine *gm, real learning_rate)
+{
+  sae->ApplyWeightDecay(gm->params, learning_rate);
+}
+
+void StackedAutoencoderTrainer::FlushWeightDecay()
+{
+  sae->FlushWeightDecay();
+}
+
+// The machine trained may forward through layers that it does not train,
+// e.g. an autoencoder through the encoders below it.
+void StackedAutoencoderTrainer::CopyParameters(GradientMachine *from, GradientMachine *to)
+{
+  StackedAutoencoder *copy = ((StackedAutoencoderTrainer*)replicas[0])->sae->params_owner;
+  if(from == machine)
+    StochasticGradientPlus::CopyParameters(sae->sup_unsup_machine, copy->sup_unsup_machine);
+  else
+    StochasticGradientPlus::CopyParameters(copy->sup_unsup_machine, sae->sup_unsup_machine);
+}
+
+// The outputs of the sae are stored for all the examples of a DataSet, then
+// set back one example at a time for the measurers.
+void StackedAutoencoderTrainer::MeasureDataSets(DataSet **datas, Measurer ***meas, int *n_meas,
+                                                int n_datas, int first_data)
+{
+  if(!parallel_evaluation || n_threads <= 1 || n_replicas < n_threads || asynchronous_evaluation
+     || layerwise_training || topK_training)    {
+    StochasticGradientPlus::MeasureDataSets(datas, meas, n_meas, n_datas, first_data);
+    return;
+  }
+
+  // The training set, whose measurers may read more than the outputs, is
+  // left to this machine.
+  if(first_data == 0)   {
+    StochasticGradientPlus::MeasureDataSets(datas, meas, n_meas, 1, 0);
+    first_data = 1;
+  }
+
+  int n_outputs = sae->outputs->frame_size;
+  for(int julie = first_data; julie < n_datas; julie++)        {
+    DataSet *dataset = datas[julie];
+    if(n_meas[julie] == 0)
+      continue;
+
+    // One output frame per input frame.
+    Allocator *allocator_ = new Allocator;
+    int n_examples = dataset->n_examples;
+    long *offsets = (long*)allocator_->alloc(sizeof(long)*(n_examples+1));
+    offsets[0] = 0;
+    for(int t = 0; t < n_examples; t++)   {
+      int n_frames;
+      dataset->getNumberOfFrames(t, &n_frames, NULL);
+      offsets[t+1] = offsets[t] + (long)n_frames*n_outputs;
     }
-    if (finetuning_learning_rates[sae->n_hidden_layers] > 0.)
-      StochasticGradientPlus::UpdateMachine(sae->outputer, finetuning_learning_rates[sae->n_hidden_layers]);
+    real *stored_outputs = (real*)allocator_->alloc(sizeof(real)*(offsets[n_examples] > 0 ? offsets[n_examples] : 1));
+
+    SharedDataSet **views = (SharedDataSet**)allocator_->alloc(sizeof(SharedDataSet*)*n_threads);
+    for(int r = 0; r < n_threads; r++)
+      views[r] = new(allocator_) SharedDataSet(dataset);
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(n_threads) schedule(static, 1)
+#endif
+    for(int r = 0; r < n_threads; r++)  {
+      StackedAutoencoderTrainer *replica = (StackedAutoencoderTrainer*)replicas[r];
+      int begin = (int)(((long)n_examples*r)/n_threads);
+      int end = (int)(((long)n_examples*(r+1))/n_threads);
+      for(int t = begin; t < end; t++)  {
+        views[r]->setExample(t);
+        replica->machine->forward(views[r]->inputs);
+
+        Sequence *outputs = replica->sae->outputs;
+        real *ptr = stored_outputs + offsets[t];
+        for(int f = 0; f < outputs->n_frames; f++)      {
+          memcpy(ptr, outputs->frames[f], sizeof(real)*n_outputs);
+          ptr += n_outputs;
+        }
+      }
+    }
+
+    Sequence *outputs = sae->outputs;
+    for(int t = 0; t < n_examples; t++)
+    {
+      dataset->setExample(t);
+      int n_frames = (int)((offsets[t+1] - offsets[t])/n_outputs);
+      outputs->resize(n_frames);
+      real *ptr = stored_outputs + offsets[t];
+      for(int f = 0; f < n_frames; f++)   {
+        memcpy(outputs->frames[f], ptr, sizeof(real)*n_outputs);
+        ptr += n_outputs;
+      }
+
+      for(int i = 0; i < n_meas[julie]; i++)
+        meas[julie][i]->measureExample();
+    }
+
+    for(int i = 0; i < n_meas[julie]; i++)
+      meas[julie][i]->measureIteration();
+
+    delete allocator_;
   }
 }
 
+DataSet *StackedAutoencoderTrainer::SyncReplica(int r, DataSet *data)
+{
+  StackedAutoencoderTrainer *replica = (StackedAutoencoderTrainer*)replicas[r];
+  StackedAutoencoder *replica_sae = replica->sae;
+  // Under asynchronous evaluation, the replicas train a copy of the sae.
+  if(asynchronous_evaluation)   {
+    StackedAutoencoder *copy = ((StackedAutoencoderTrainer*)replicas[0])->sae->params_owner;
+    if(!copy || replica_sae->params_owner != copy)
+      error("StackedAutoencoderTrainer::SyncReplica - replica %d does not share the parameters of the copy.", r);
+  }     else if(replica_sae->params_owner != sae)
+    error("StackedAutoencoderTrainer::SyncReplica - replica %d does not share our parameters.", r);
+
+  // How to train
+  replica->layerwise_training = layerwise_training;
+  replica->layerwise_layer = layerwise_layer;
+  replica->topK_training = topK_training;
+  replica->topKlayers = topKlayers;
+  replica->is_finetuning = is_finetuning;
+  replica->do_eval_criterion_weights = do_eval_criterion_weights;
+  replica->sample_criterion_weights = sample_criterion_weights;
+  for(int i=0; i<sae->n_hidden_layers+1; i++)
+    replica->finetuning_learning_rates[i] = finetuning_learning_rates[i];
+
+  for(int i=0; i<sae->n_hidden_layers; i++)
+    replica_sae->encoders[i]->setPartialBackprop(sae->encoders[i]->partial_backprop);
+  replica_sae->outputer->setPartialBackprop(sae->outputer->partial_backprop);
+
+  // The machine
+  replica->machine = NULL;
+  if(machine == sae)
+    replica->machine = replica_sae;
+  else if(machine == sae->unsup_machine)
+    replica->machine = replica_sae->unsup_machine;
+  else if(machine == sae->sup_unsup_machine)
+    replica->machine = replica_sae->sup_unsup_machine;
+  for(int i=0; i<sae->n_hidden_layers; i++)     {
+    if(machine == sae->mesd_machines[i])
+      replica->machine = replica_sae->mesd_machines[i];
+    if(machine == sae->autoencoders[i])
+      replica->machine = replica_sae->autoencoders[i];
+  }
+  if(!replica->machine)
+    error("StackedAutoencoderTrainer::SyncReplica - this training can't be threaded.");
+
+  // The DataSet. The supervised criterion gets it, as in TrainSupUnsup.
+  DataSet *replica_data = replica_datas[r];
+  replica->sup_dataset = replica_data;
+  replica->sup_criterion->setDataSet(replica_data);
+  for(int i=0; i<sae->n_hidden_layers; i++)     {
+    if(data == unsup_datasets[i])
+      replica_data = replica->unsup_datasets[i];
+  }
+  // The replica reads the cache through its own view.
+  if(replica->layer_cache)      {
+    replica->allocator->free(replica->layer_cache);
+    replica->layer_cache = NULL;
+  }
+  if(layer_cache && data == layer_cache)  {
+    replica->layer_cache = new(replica->allocator) CachedDataSet(layer_cache);
+    replica_data = replica->layer_cache;
+  }
+
+  // The criterion. A concatenation is rebuilt with the replica's criterions
+  // and our weights.
+  if(replica->concat_criterion) {
+    Criterion **old_criterions = replica->concat_criterion->criterions;
+    replica->allocator->free(replica->concat_criterion);
+    allocator->free(old_criterions);
+    replica->concat_criterion = NULL;
+  }
+  if(criterion == concat_criterion)     {
+    int n_criterions = concat_criterion->n_criterions;
+    Criterion **the_criterions = (Criterion **) allocator->alloc(sizeof(Criterion *)*n_criterions);
+    for(int i=0; i<n_criterions; i++)
+      the_criterions[i] = ReplicaCriterion(replica, concat_criterion->criterions[i]);
+
+    int n_outputs = ((GradientMachine*)replica->machine)->n_outputs;
+    replica->concat_criterion = new(replica->allocator) ConcatCriterion(n_outputs,
+                                                                        n_criterions,
+                                                                        the_criterions,
+                                                                        concat_criterion->criterion_weights);
+    replica->criterion = replica->concat_criterion;
+  }     else
+    replica->criterion = ReplicaCriterion(replica, criterion);
+
+  return replica_data;
+}
+
+Criterion *StackedAutoencoderTrainer::ReplicaCriterion(StackedAutoencoderTrainer *replica,
+                                                       Criterion *the_criterion)
+{
+  if(the_criterion == sup_criterion)
+    return replica->sup_criterion;
+  for(int i=0; i<sae->n_hidden_layers; i++)     {
+    if(the_criterion == unsup_criterions[i])
+      return replica->unsup_criterions[i];
+  }
+
+  error("StackedAutoencoderTrainer::ReplicaCriterion - unknown criterion.");
+  return NULL;
+}
+
 // TODO set autoencoder to do partial bprop
 void StackedAutoencoderTrainer::TrainUnsupLayerwise()
 {
@@ -312,9 +618,31 @@ void StackedAutoencoderTrainer::TrainUnsupLayerwise()
 
   for(int i=0; i<sae->n_hidden_layers; i++)     {
     layerwise_layer = i;
+
+    // The outputs of the layer below, from the ones of the layer before.
+    if(cache_lower_layers && i > 0)   {
+      DataSet *lower_data = (layer_cache ? (DataSet*)layer_cache : unsup_datasets[0]);
+      std::string file_name;
+      if(!cache_file_prefix.empty())    {
+        std::stringstream ss;
+        ss << cache_file_prefix << "layer" << i-1 << ".cache";
+        file_name = ss.str();
+      }
+      CachedDataSet *new_cache = new(allocator) CachedDataSet(lower_data, sae->encoders[i-1],
+                                                              sae->encoders[i-1]->outputs,
+                                                              file_name);
+      if(layer_cache)
+        allocator->free(layer_cache);
+      layer_cache = new_cache;
+    }
+
     TrainUnsupLayer();
   }
 
+  if(layer_cache)       {
+    allocator->free(layer_cache);
+    layer_cache = NULL;
+  }
   layerwise_training = false;
 }
 
@@ -375,14 +703,10 @@ void StackedAutoencoderTrainer::TrainSelectiveUnsup(int* pretrain_list, bool par
     // In the partial_backprop case we want ALL encoders to do partial bprop
     // and, if noisy, the selectively pretrained autoencoders as well.
     // (this can save some computations).
+    // A Coder doing partial backprop still resizes and clears its beta in
+    // backward(), for any number of frames, so a ConnectedMachine that it is
+    // part of can use it.
     sae->encoders[i]->setPartialBackprop(partial_backprop);
-    // This means it will not update its beta. However, a ConnectedMachine
-    // that it is part of will use the beta. Hence, we must resize it
-    // and clear it. The HACK is that we assume sequences of 1 frame.
-    if (partial_backprop) {
-      //sae->encoders[i]->beta->resize(1); 
-      ClearSequence(sae->encoders[i]->beta);
-    }
 
     if (pretrain_list[i]==1)  {
       // Just plug the decoder into its (non-noisy) encoder
@@ -392,11 +716,11 @@ void StackedAutoencoderTrainer::TrainSelectiveUnsup(int* pretrain_list, bool par
       // Use the autoencoder (it's noisy)
       }     else    {
         // Do we want to backpropagate the gradient to the lower layers?
+        // The autoencoder is a ConnectedMachine, which leaves its beta alone
+        // with partial backprop. Clear it once: it is never written to.
         sae->autoencoders[i]->setPartialBackprop(partial_backprop);
-        if (partial_backprop) {
-          //sae->autoencoders[i]->beta->resize(1);
+        if (partial_backprop)
           ClearSequence(sae->autoencoders[i]->beta);
-        }
 
         // if not the first layer, connect (noisy) autoencoder to lower encoder
         if(i>0) {
@@ -434,7 +758,6 @@ void StackedAutoencoderTrainer::TrainSelectiveUnsup(int* pretrain_list, bool par
 
   // The concat_criterion
   // NOT applying any weights to the criteria.
-  Criterion *concat_criterion;
   concat_criterion = new(allocator) ConcatCriterion(selective_machine->n_outputs,
                                                  n_layers_to_train,
                                                  the_criterions,
@@ -475,6 +798,7 @@ void StackedAutoencoderTrainer::TrainSelectiveUnsup(int* pretrain_list, bool par
   allocator->free(selective_machine);
   allocator->free(the_criterions);
   allocator->free(concat_criterion);
+  concat_criterion = NULL;
   for (int i = 0; i < the_measurers.n_nodes; i++)
     allocator->free(the_measurers.nodes[i]);
 
@@ -491,6 +815,28 @@ void StackedAutoencoderTrainer::TrainUnsupLayer()
      << ". No bprop to lower layers.";
   message(ss.str().c_str());
 
+  // The autoencoder alone, on the cached outputs of the layer below: the
+  // usual forward and backward of the machine.
+  if(layer_cache)   {
+    machine = sae->autoencoders[layerwise_layer];
+    criterion = unsup_criterions[layerwise_layer];
+    Measurer *measurer = unsup_measurers[layerwise_layer];
+    DataSet *measurer_data = measurer->data;
+    measurer->data = layer_cache;
+    MeasurerList the_measurers;
+    the_measurers.addNode(measurer);
+
+    layerwise_training = false;
+    train(layer_cache, &the_measurers);
+    layerwise_training = true;
+
+    measurer->data = measurer_data;
+    criterion->setDataSet(unsup_datasets[layerwise_layer]);
+    machine = sae;
+    criterion = sup_criterion;
+    return;
+  }
+
   // This will be used by the train function: setData, iterInitialize,
   // clearDerivatives and updateMachine. That's actually not ideal, as we only
   // backward the autoencoder.
@@ -506,6 +852,7 @@ void StackedAutoencoderTrainer::TrainUnsupLayer()
 }
 
 // Could gain in efficiency by setting the bottommost encoder to do partial bprop.
+// The cached mode does.
 void StackedAutoencoderTrainer::TrainSupervisedTopKLayers(DataSet *supervised_train_data,
                                               MeasurerList *measurers,
                                               int top_k_layers)
@@ -517,6 +864,12 @@ void StackedAutoencoderTrainer::TrainSupervisedTopKLayers(DataSet *supervised_tr
 
   assert( top_k_layers>0 && top_k_layers<=sae->n_hidden_layers+1 );
 
+  int n_frozen = sae->n_hidden_layers + 1 - top_k_layers;
+  if(cache_frozen_layers && n_frozen > 0)   {
+    TrainTopKLayersOnCache(supervised_train_data, measurers, n_frozen);
+    return;
+  }
+
   topK_training = true;
   topKlayers = top_k_layers;
 
@@ -528,6 +881,80 @@ void StackedAutoencoderTrainer::TrainSupervisedTopKLayers(DataSet *supervised_tr
   topK_training = false;
 }
 
+void StackedAutoencoderTrainer::TrainTopKLayersOnCache(DataSet *supervised_train_data,
+                                                       MeasurerList *measurers, int n_frozen)
+{
+  // The frozen encoders, run once per example.
+  ConnectedMachine *frozen = new(allocator) ConnectedMachine();
+  sae->AddEncodersUpToIncluded(frozen, n_frozen-1, false);
+  frozen->build();
+
+  // The trained layers. They write the outputs of the sae, which the
+  // criterion and the measurers read. The bottom one has no beta to compute.
+  ConnectedMachine *top = new(allocator) ConnectedMachine();
+  for(int i=n_frozen; i<sae->n_hidden_layers; i++)
+    top->addFCL(sae->encoders[i]);
+  top->addFCL(sae->outputer);
+  top->build();
+  top->outputs = sae->outputs;
+  GradientMachine *bottom = (n_frozen < sae->n_hidden_layers ? (GradientMachine*)sae->encoders[n_frozen]
+                             : (GradientMachine*)sae->outputer);
+  bool bottom_partial_backprop = bottom->partial_backprop;
+  bottom->setPartialBackprop(true);
+
+  // One cache per DataSet: the training set first, then those of the
+  // measurers, which read the cache instead while we train.
+  int n_measurers = (measurers ? measurers->n_nodes : 0);
+  DataSet **datas = (DataSet**) allocator->alloc(sizeof(DataSet*)*(n_measurers+1));
+  CachedDataSet **caches = (CachedDataSet**) allocator->alloc(sizeof(CachedDataSet*)*(n_measurers+1));
+  DataSet **measurer_datas = (DataSet**) allocator->alloc(sizeof(DataSet*)*(n_measurers+1));
+  int n_datas = 0;
+  for(int m=-1; m<n_measurers; m++)     {
+    DataSet *the_data = (m < 0 ? supervised_train_data : measurers->nodes[m]->data);
+    int d = 0;
+    while(d < n_datas && datas[d] != the_data)
+      d++;
+    if(d == n_datas)    {
+      std::string file_name;
+      if(!cache_file_prefix.empty())    {
+        std::stringstream ss;
+        ss << cache_file_prefix << "frozen" << d << ".cache";
+        file_name = ss.str();
+      }
+      datas[d] = the_data;
+      caches[d] = new(allocator) CachedDataSet(the_data, frozen, sae->encoders[n_frozen-1]->outputs,
+                                               file_name, true, half_precision_cache);
+      n_datas++;
+    }
+    if(m >= 0)  {
+      measurer_datas[m] = the_data;
+      measurers->nodes[m]->data = caches[d];
+    }
+  }
+
+  std::stringstream ss;
+  ss << sae->name << " : the " << n_frozen << " frozen encoders are cached.";
+  message(ss.str().c_str());
+
+  machine = top;
+  criterion = sup_criterion;
+  train(caches[0], measurers);
+
+  machine = sae;
+  sup_criterion->setDataSet(supervised_train_data);
+  for(int m=0; m<n_measurers; m++)
+    measurers->nodes[m]->data = measurer_datas[m];
+  bottom->setPartialBackprop(bottom_partial_backprop);
+
+  for(int d=0; d<n_datas; d++)
+    allocator->free(caches[d]);
+  allocator->free(caches);
+  allocator->free(datas);
+  allocator->free(measurer_datas);
+  allocator->free(top);
+  allocator->free(frozen);
+}
+
 //--------------
 
 void StackedAutoencoderTrainer::TrainUnsupNotOutput()
@@ -552,7 +979,6 @@ void StackedAutoencoderTrainer::TrainUnsupNotOutput()
   }
 
   //
-  Criterion *concat_criterion;
   concat_criterion = new(allocator) ConcatCriterion(sae->unsup_machine->n_outputs,
                                                  sae->n_hidden_layers,
                                                  the_criterions,
@@ -579,6 +1005,7 @@ void StackedAutoencoderTrainer::TrainUnsupNotOutput()
 
   machine = sae;
   criterion = sup_criterion;
+  concat_criterion = NULL;
 
 }
 
@@ -591,13 +1018,9 @@ void StackedAutoencoderTrainer::TrainUnsup(DataSet *supervised_train_data,
   ss << sae->name << " : training with unsupervised costs and training the outputer (ignore next line).";
   message(ss.str().c_str());
 
-  // Set the outputer to do partial backprop
-  // This means it will not update its beta. However, a ConnectedMachine
-  // that it is part of will use the beta. Hence, we must resize it
-  // and clear it. The HACK is that we assume sequences of 1 frame.
+  // Set the outputer to do partial backprop. Its beta is then resized and
+  // cleared by Coder::backward for the ConnectedMachine that uses it.
   sae->outputer->setPartialBackprop(true);
-  sae->outputer->beta->resize(1);
-  ClearSequence(sae->outputer->beta);
 
   // Train
   TrainSupUnsup(supervised_train_data, measurers, 1.0);
@@ -637,7 +1060,6 @@ void StackedAutoencoderTrainer::TrainSupUnsup(DataSet *supervised_train_data,
   }
 
   //
-  Criterion *concat_criterion;
   concat_criterion = new(allocator) ConcatCriterion(sae->sup_unsup_machine->n_outputs,
                                                  1+sae->n_hidden_layers,
                                                  the_criterions,
@@ -675,6 +1097,7 @@ void StackedAutoencoderTrainer::TrainSupUnsup(DataSet *supervised_train_data,
 
   machine = sae;
   criterion = sup_criterion;
+  concat_criterion = NULL;
 
 }
 
@@ -695,6 +1118,7 @@ void StackedAutoencoderTrainer::ProfileGradientsInitialize()
   unsup_saved_grads = (real**)allocator->alloc(sizeof(real*)*sae->n_hidden_layers);
 
   saved_grads = (real***)allocator->alloc(sizeof(real**)*sae->n_hidden_layers);
+  sup_betas = (Sequence**)allocator->alloc(sizeof(Sequence*)*sae->n_hidden_layers);
 
   gradient_angle_measurers = (MeasurerList*)new(allocator) MeasurerList();
 
@@ -726,16 +1150,10 @@ void StackedAutoencoderTrainer::ProfileGradientsInitialize()
     ss.clear();
     ss << expdir << "grad/stats_grad_sup_" << i << ".txt";
     DiskXFile *file_grad_sup = new(allocator) DiskXFile(ss.str().c_str(),"w");
-    StatisticsMeasurer *measurer_grad_sup = NULL;
-    if(i<sae->n_hidden_layers-1)       {
-      measurer_grad_sup = new(allocator) StatisticsMeasurer(NULL,
-                                                            file_grad_sup,
-                                                            sae->encoders[i+1]->beta);
-    }   else    {
-      measurer_grad_sup = new(allocator) StatisticsMeasurer(NULL,
-                                                            file_grad_sup,
-                                                            sae->outputer->beta);
-    }
+    sup_betas[i] = new(allocator) Sequence(0, sae->encoders[i]->n_outputs);
+    StatisticsMeasurer *measurer_grad_sup = new(allocator) StatisticsMeasurer(NULL,
+                                                                              file_grad_sup,
+                                                                              sup_betas[i]);
     sup_gradient_measurers->addNode(measurer_grad_sup);
 
     // Gradient from the decoder
@@ -771,28 +1189,25 @@ void StackedAutoencoderTrainer::ProfileGradientsInitialize()
   }
 }
 
-// Ok inefficient... we backprop so many times.
+// One backward with all the costs, as in training, gives the upper and
+// decoder gradients. The supervised part of the upper gradients is then split
+// off by backpropagating the supervised beta alone, betas only: the
+// derivatives are those of the training backward.
 void StackedAutoencoderTrainer::ProfileLocalGradMeasureExample(DataSet *data)
 {
-  // supervised gradient
-  sae->backward(data->inputs, sup_criterion->beta);
-
-  for(int i=0; i<sae->n_hidden_layers; i++)     {
-    sup_gradient_measurers->nodes[i]->measureExample();
-
-    if(i<sae->n_hidden_layers-1)       {
-      sae->encoders[i+1]->beta->copyTo(sup_saved_grads[i]);
-    }   else    {
-      sae->outputer->beta->copyTo(sup_saved_grads[i]);
-    }
-  }
-
-  // CLEAR!
-  ClearDerivatives(sae);
-
   // Gradient from upper (all costs) and decoder gradient
   ((GradientMachine *)machine)->backward(data->inputs, criterion->beta);
 
+  // Supervised gradient, from the top down. With several costs, the beta of
+  // the supervised cost is the first slice of the concat criterion's.
+  Sequence *sup_beta = sup_criterion->beta;
+  if(criterion == concat_criterion)
+    sup_beta = concat_criterion->criterion_betas[0];
+  int top = sae->n_hidden_layers-1;
+  sae->outputer->BackwardBeta(sup_beta, sup_betas[top]);
+  for(int i=top-1; i>=0; i--)
+    sae->encoders[i+1]->BackwardBeta(sup_betas[i+1], sup_betas[i]);
+
   for(int i=0; i<sae->n_hidden_layers; i++)     {
 
     // Upper
@@ -804,6 +1219,10 @@ void StackedAutoencoderTrainer::ProfileLocalGradMeasureExample(DataSet *data)
       sae->outputer->beta->copyTo(upper_saved_grads[i]);
     }
 
+    // Supervised
+    sup_gradient_measurers->nodes[i]->measureExample();
+    sup_betas[i]->copyTo(sup_saved_grads[i]);
+
     // From decoder
     unsup_gradient_measurers->nodes[i]->measureExample();
     sae->decoders[i]->beta->copyTo(unsup_saved_grads[i]);
@@ -28,6 +28,9 @@ namespace Torch {
 
 class StackedAutoencoder;
 class Measurer;
+class ConcatCriterion;
+class CachedDataSet;
+class GradientStatistics;
 
 // Trainer for a StackedAutoencoder
 //
@@ -73,6 +76,24 @@ class StackedAutoencoderTrainer : public StochasticGradientPlus
 
     real *criterions_weights;
 
+    // With do_eval_criterion_weights, each epoch the unsupervised criterions
+    // are weighed by sqrt(v_sup / v_i), with v the largest variance of a
+    // parameter's gradient under the criterion. By default, the variances
+    // are gathered online from the training gradients of the parameters
+    // that only the criterion reaches: the outputer for the supervised one
+    // and decoder i for unsupervised criterion i. With "sample criterion
+    // weights", they are estimated at the start of each epoch on
+    // "criterion weight samples" examples, for all the parameters of sae
+    // and mesd_machines[i], split across the replicas if threaded. With tied
+    // weights, the decoders only have their bias to themselves: the weights
+    // are then always sampled (see SamplesCriterionWeights).
+    bool sample_criterion_weights;
+    int n_criterion_weight_samples;
+    GradientStatistics **criterion_gradient_stats;    // 1+n_hidden_layers
+
+    // The criterion of the current phase, if it is a concatenation.
+    ConcatCriterion *concat_criterion;
+
     bool layerwise_training;
     int layerwise_layer;
     bool topK_training;
@@ -81,12 +102,36 @@ class StackedAutoencoderTrainer : public StochasticGradientPlus
 
     real *finetuning_learning_rates;
 
+    // With "cache lower layers", TrainUnsupLayerwise computes the outputs of
+    // layer k-1 on the training set once, from those of layer k-2, and trains
+    // autoencoder k alone on them (see CachedDataSet). The lower layers are
+    // then left completely alone, including their weight decay. The cache is
+    // in memory, or in a file named from cache_file_prefix if it is set.
+    bool cache_lower_layers;
+    std::string cache_file_prefix;
+    CachedDataSet *layer_cache;
+    // With "cache frozen layers", TrainSupervisedTopKLayers computes the
+    // outputs of the frozen encoders once for the training set and for the
+    // DataSets of the measurers, and trains the top k layers on them. With
+    // "half precision cache", they are stored as half floats.
+    bool cache_frozen_layers;
+    bool half_precision_cache;
+
+    // With "parallel evaluation" and threads, the DataSets other than the
+    // training one are forwarded in parallel, each thread on the execution
+    // context of its replica, and their measurers then read the outputs of
+    // the sae example by example. Their measurers must only read these
+    // outputs (and the targets), as the classification measurers do. Not for
+    // the layerwise and top k trainings, nor under asynchronous evaluation.
+    bool parallel_evaluation;
+
     // Gradient profiling
     bool profile_gradients;
     MeasurerList *upper_gradient_measurers;     // gradient from upper encoder
                                                 // when all costs
     MeasurerList *sup_gradient_measurers;       // gradient from upper encoder
                                                 // when only sup cost.
+                                                // Measured on sup_betas.
     MeasurerList *unsup_gradient_measurers;     // gradient from decoder
 
     real **upper_saved_grads;
@@ -94,6 +139,10 @@ class StackedAutoencoderTrainer : public StochasticGradientPlus
     real **unsup_saved_grads;
     real ***saved_grads;
 
+    // The part of the gradient from the upper encoder due to the supervised
+    // cost, split from the full backward by Coder::BackwardBeta.
+    Sequence **sup_betas;
+
     MeasurerList *gradient_angle_measurers;
 
     // Take the #machine_# to train and the supervised #criterion_# to use.
@@ -103,7 +152,24 @@ class StackedAutoencoderTrainer : public StochasticGradientPlus
                                        bool do_eval_criterion_weights_=false,
                                        XFile* resultsfile_=NULL);
 
-    virtual real EvalHessian(GradientMachine *the_gm, Criterion* the_criterion, DataSet *the_data, int n_samples);
+    // The machine, criterion and data of criterion #c# (0 for the supervised
+    // one, 1+i for unsupervised criterion i).
+    virtual GradientMachine *WeighedMachine(int c);
+    virtual Criterion *WeighedCriterion(int c);
+    virtual DataSet *WeighedData(int c);
+    // Adds the gradients of criterion #c# on examples #begin# to #end# of
+    // #the_data# to criterion_gradient_stats[c], one sample per example.
+    virtual void SampleCriterionGradients(int c, DataSet *the_data, int begin, int end);
+    // Samples #n_samples# examples for each criterion, in the replicas'
+    // threads if threaded.
+    virtual void SampleCriterionsGradients(int n_samples);
+    // True if the criterion weights are estimated on samples rather than
+    // online: with "sample criterion weights", or with tied weights.
+    virtual bool SamplesCriterionWeights();
+    // Adds the training gradients of the current update (see above).
+    virtual void AddTrainingCriterionGradients(int n_examples);
+    // Sets criterions_weights from the statistics, and resets them.
+    virtual void EvalCriterionWeights();
     virtual void ClearSequence(Sequence *seq);
 
     virtual void TrainInitialize();
@@ -111,7 +177,26 @@ class StackedAutoencoderTrainer : public StochasticGradientPlus
     virtual void IterInitialize();
     virtual void IterFinalize();
     virtual void fpropbprop(DataSet *data);
+    virtual void PrepareUpdate(int n_examples);
+    virtual void PrepareOptimizer(GradientMachine *gm);
     virtual void UpdateMachine(GradientMachine *gm, real current_learning_rate);
+    // Through the derivatives_touched flags of the coders of the sae.
+    virtual void FindTouchedArrays(Parameters *der_params, bool *touched);
+    virtual void SetTouched(Parameters *der_params, bool touched);
+    virtual void ApplyWeightDecay(GradientMachine *gm, real learning_rate);
+    virtual void FlushWeightDecay();
+    // Copies all the parameters of the sae to or from the copy trained under
+    // asynchronous evaluation, not only the ones of the machine trained.
+    virtual void CopyParameters(GradientMachine *from, GradientMachine *to);
+    // See parallel_evaluation.
+    virtual void MeasureDataSets(DataSet **datas, Measurer ***meas, int *n_meas,
+                                 int n_datas, int first_data);
+
+    // The replicas are StackedAutoencoderTrainers of replicas of the sae.
+    // Selective training builds its machine on the fly and can't be threaded.
+    virtual DataSet *SyncReplica(int r, DataSet *data);
+    // The replica's counterpart of one of our criterions.
+    virtual Criterion *ReplicaCriterion(StackedAutoencoderTrainer *replica, Criterion *the_criterion);
 
     virtual void TrainSelectiveUnsupLayerwise(int* pretrain_list);
     virtual void TrainSelectiveUnsup(int* pretrain_list, bool partial_backprop);
@@ -119,6 +204,10 @@ class StackedAutoencoderTrainer : public StochasticGradientPlus
     virtual void TrainUnsupLayer();
     virtual void TrainSupervisedTopKLayers(DataSet *supervised_train_data,
                                   MeasurerList *measurers, int top_k_layers);
+    // Trains the layers above the #n_frozen# first encoders on their cached
+    // outputs.
+    virtual void TrainTopKLayersOnCache(DataSet *supervised_train_data,
+                                        MeasurerList *measurers, int n_frozen);
 
     virtual void TrainUnsupNotOutput();
     virtual void TrainUnsup(DataSet *data, MeasurerList *measurers);
@@ -15,6 +15,10 @@
 
 #include "stochastic_gradient_plus.h"
 #include "Random.h"
+#include "coder.h"
+#include "parameter_arena.h"
+#include "minibatch_data_set.h"
+#include "derivatives_reader.h"
 
 namespace Torch {
 
@@ -22,6 +26,32 @@ StochasticGradientPlus::StochasticGradientPlus(GradientMachine *machine_, Criter
     : StochasticGradient(machine_, criterion_)
 {
   resultsfile = resultsfile_;
+  n_accumulated_examples = 0;
+  minibatch_data = NULL;
+  decayed_coders = NULL;
+  n_decayed_coders = 0;
+  replicas = NULL;
+  replica_datas = NULL;
+  n_replicas = 0;
+  cleared_machines = NULL;
+  n_cleared_machines = 0;
+  touched_arrays = NULL;
+  n_touched_arrays = 0;
+  first_listings = NULL;
+  n_first_listings = 0;
+  measurers_need_derivatives = false;
+  optimizer = new(allocator) Optimizer();
+  evaluating = false;
+  evaluated_datas = NULL;
+  evaluated_meas = NULL;
+  evaluated_n_meas = NULL;
+  evaluated_n_datas = 0;
+
+  addIOption("minibatch size", &minibatch_size, 1, "number of examples whose gradients are averaged for each update");
+  addIOption("n threads", &n_threads, 1, "number of threads training the replicas, lock-free");
+  addBOption("synchronous threads", &synchronous_threads, false, "split the minibatches across the threads and sum their gradients, reproducibly");
+  addBOption("keep derivatives", &keep_derivatives, false, "keep der_params after the updates, even if no measurer reads them");
+  addBOption("asynchronous evaluation", &asynchronous_evaluation, false, "measure each epoch in a thread while the next one trains");
 }
 
 
@@ -37,6 +67,43 @@ void StochasticGradientPlus::train(DataSet *data, MeasurerList *measurers)
 
   machine->setDataSet(data);
   criterion->setDataSet(data);
+  n_cleared_machines = 0;
+  measurers_need_derivatives = NeedsDerivatives(measurers);
+  PrepareOptimizer((GradientMachine*)machine);
+  optimizer->Reset();
+
+  // The replicas train, this machine only measures.
+  bool threaded = (n_threads > 1);
+  DataSet **thread_datas = NULL;
+  if(threaded)  {
+    if(n_replicas < n_threads)
+      error("StochasticGradientPlus: %d threads need as many replicas (%d given)", n_threads, n_replicas);
+
+    thread_datas = (DataSet **)Allocator::sysAlloc(n_threads*sizeof(DataSet *));
+    for(int r = 0; r < n_threads; r++)  {
+      thread_datas[r] = SyncReplica(r, data);
+      replicas[r]->n_cleared_machines = 0;
+      replicas[r]->optimizer = optimizer;
+      replicas[r]->machine->setDataSet(thread_datas[r]);
+      replicas[r]->criterion->setDataSet(thread_datas[r]);
+      replicas[r]->criterion->reset();
+    }
+  }
+
+  bool gathered = (!threaded && GathersMinibatches(data));
+
+  // The replicas train a copy of the model, and this machine holds the
+  // snapshot being evaluated.
+  if(asynchronous_evaluation)   {
+    if(!threaded)
+      error("StochasticGradientPlus: asynchronous evaluation needs the threaded training.");
+    GradientMachine *copy = (GradientMachine *)replicas[0]->machine;
+    if(copy->params->n_data > 0
+       && copy->params->data[0] == ((GradientMachine *)machine)->params->data[0])
+      error("StochasticGradientPlus: asynchronous evaluation needs replicas of a copy of the machine.");
+    CopyParameters((GradientMachine *)machine, copy);
+    PrepareOptimizer(copy);
+  }
 
   if(measurers) {
     for(int i = 0; i < measurers->n_nodes; i++)
@@ -61,44 +128,11 @@ void StochasticGradientPlus::train(DataSet *data, MeasurerList *measurers)
    IterInitialize();
   ((GradientMachine *)machine)->iterInitialize();
 
-  // Measure on datasets other than the train dataset
-  // le data 0 est le train dans tous les cas...
-  for(int julie = 0; julie < n_datas; julie++)        {
-    DataSet *dataset = datas[julie];
-
-    for(int t = 0; t < dataset->n_examples; t++)
-    {
-      dataset->setExample(t);
-      machine->forward(dataset->inputs);
-
-      for(int i = 0; i < n_meas[julie]; i++)
-        meas[julie][i]->measureExample();
-    }
-
-    for(int i = 0; i < n_meas[julie]; i++)
-      meas[julie][i]->measureIteration();
-  }
+  // Measure on all the datasets, the train one included
+  MeasureDataSets(datas, meas, n_meas, n_datas, 0);
 
   IterFinalize();
-  if (resultsfile) {
-    // Writing all the errors to a results files. Assumes 
-    // - that each used measurer has a filed called "internal_error" 
-    // (which is the case for most standard measurers which return
-    // a single real as a result
-    // - that internal_error is a real
-    real current_meas_err = 0.;
-    for(int julie = 0; julie < n_datas; julie++)  {
-      for(int i = 0; i < n_meas[julie]; i++) {
-        current_meas_err = meas[julie][i]->current_error;
-        //if (binary_mode)
-        //  resultsfile->write(current_meas_err,sizeof(real),1);
-        //else
-        resultsfile->printf("%g ",current_meas_err);
-      }
-    }
-    resultsfile->printf("\n");
-    resultsfile->flush();
-  }
+  WriteResults(meas, n_meas, n_datas);
   //---------- End of ugly hack
 
 
@@ -106,72 +140,116 @@ void StochasticGradientPlus::train(DataSet *data, MeasurerList *measurers)
   {
     IterInitialize();
 
-    ((GradientMachine *)machine)->iterInitialize();
-    criterion->iterInitialize();
+    // Under asynchronous evaluation, the machine and the criterion may be in
+    // use by the evaluation thread, which initializes them itself.
+    if(!asynchronous_evaluation)  {
+      ((GradientMachine *)machine)->iterInitialize();
+      criterion->iterInitialize();
+    }
     err = 0;
 
-    for(int t = 0; t < n_train; t++)
-    {
-
-      ClearDerivatives((GradientMachine*)machine);
+    if(threaded)  {
+      for(int r = 0; r < n_threads; r++)  {
+        ((GradientMachine *)replicas[r]->machine)->iterInitialize();
+        replicas[r]->criterion->iterInitialize();
+      }
 
-      data->setExample(shuffle[t]);
+      if(synchronous_threads)
+        err = TrainSynchronous(thread_datas, shuffle, n_train, current_learning_rate);
+      else    {
+        // Each thread trains a contiguous part of the shuffled examples.
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(n_threads) schedule(static, 1) reduction(+:err)
+#endif
+        for(int r = 0; r < n_threads; r++)  {
+          int begin = (int)(((long)n_train*r)/n_threads);
+          int end = (int)(((long)n_train*(r+1))/n_threads);
+          err += TrainReplica(replicas[r], thread_datas[r], shuffle+begin, end-begin,
+                              current_learning_rate);
+        }
+      }
 
-      fpropbprop(data);
+      for(int r = 0; r < n_threads; r++)
+        replicas[r]->FlushWeightDecay();
+    } else if(gathered)  {
+      // Each minibatch is one example of minibatch_data.
+      for(int t = 0; t < n_train; t += minibatch_size)
+      {
+        int n_examples = (n_train-t < minibatch_size ? n_train-t : minibatch_size);
+        ClearDerivatives((GradientMachine*)machine);
+        minibatch_data->SetMinibatch(shuffle+t, n_examples);
 
-      for(int i = 0; i < n_meas[0]; i++)
-        meas[0][i]->measureExample();
+        fpropbprop(data);
+        n_accumulated_examples = n_examples;
 
-      UpdateMachine((GradientMachine*)machine, current_learning_rate);
+        Sequence *costs = criterion->outputs;
+        for(int f = 0; f < costs->n_frames; f++)
+          err += costs->frames[f][0];
 
-      // Note que peut-etre faudrait foutre un "accumul_erreur" dans la classe
-      // Criterion des fois que ca soit pas une somme... Mais bon, a priori ca
-      // vient d'une integrale, donc me gonflez pas. PREVENIR ICI L'UTILISATEUR
-      // DE L'UTILITE DE L'OUTPUT DANS UN CRITERION
-      err += criterion->outputs->frames[0][0];
+        PrepareUpdate(n_accumulated_examples);
+        UpdateMachine((GradientMachine*)machine, current_learning_rate/(real)n_accumulated_examples);
+      }
+    } else  {
+      for(int t = 0; t < n_train; t++)
+      {
+        if(IsMinibatchStart(t))   {
+          ClearDerivatives((GradientMachine*)machine);
+          n_accumulated_examples = 0;
+        }
+
+        data->setExample(shuffle[t]);
+
+        fpropbprop(data);
+        n_accumulated_examples++;
+
+        for(int i = 0; i < n_meas[0]; i++)
+          meas[0][i]->measureExample();
+
+        // The gradient is a sum over the minibatch: average it.
+        if(IsMinibatchEnd(t, n_train))    {
+          PrepareUpdate(n_accumulated_examples);
+          UpdateMachine((GradientMachine*)machine, current_learning_rate/(real)n_accumulated_examples);
+        }
+
+        // Note que peut-etre faudrait foutre un "accumul_erreur" dans la classe
+        // Criterion des fois que ca soit pas une somme... Mais bon, a priori ca
+        // vient d'une integrale, donc me gonflez pas. PREVENIR ICI L'UTILISATEUR
+        // DE L'UTILITE DE L'OUTPUT DANS UN CRITERION
+        err += criterion->outputs->frames[0][0];
+      }
     }
 
-    for(int i = 0; i < n_meas[0]; i++)
-      meas[0][i]->measureIteration();
+    // Measure on the train dataset, with the parameters of the end of the
+    // epoch. The evaluation thread does it in the asynchronous case.
+    if((threaded || gathered) && n_meas[0] > 0 && !asynchronous_evaluation) {
+      for(int t = 0; t < n_train; t++)      {
+        data->setExample(t);
+        machine->forward(data->inputs);
 
-    // Measure on datasets other than the train dataset
-    // le data 0 est le train dans tous les cas...
-    for(int julie = 1; julie < n_datas; julie++)        {
-      DataSet *dataset = datas[julie];
+        for(int i = 0; i < n_meas[0]; i++)
+          meas[0][i]->measureExample();
+      }
+    }
 
-      for(int t = 0; t < dataset->n_examples; t++)
-      {
-        dataset->setExample(t);
-        machine->forward(dataset->inputs);
+    // The machine must be done with the evaluation of the previous epoch.
+    WaitEvaluation();
+    FlushWeightDecay();
 
-        for(int i = 0; i < n_meas[julie]; i++)
-          meas[julie][i]->measureExample();
-      }
+    if(asynchronous_evaluation) {
+      // The snapshot of this epoch is evaluated while the next one trains.
+      CopyParameters((GradientMachine *)replicas[0]->machine, (GradientMachine *)machine);
+      StartEvaluation(datas, meas, n_meas, n_datas);
+    }   else  {
+      for(int i = 0; i < n_meas[0]; i++)
+        meas[0][i]->measureIteration();
 
-      for(int i = 0; i < n_meas[julie]; i++)
-        meas[julie][i]->measureIteration();
+      // Measure on datasets other than the train dataset
+      MeasureDataSets(datas, meas, n_meas, n_datas, 1);
     }
 
     IterFinalize();
-    if (resultsfile) {
-      // Writing all the errors to a results files. Assumes 
-      // - that each used measurer has a filed called "internal_error" 
-      // (which is the case for most standard measurers which return
-      // a single real as a result
-      // - that internal_error is a real
-      real current_meas_err = 0.;
-      for(int julie = 0; julie < n_datas; julie++)  {
-         for(int i = 0; i < n_meas[julie]; i++) {
-           current_meas_err = meas[julie][i]->current_error;
-           //if (binary_mode)
-           //  resultsfile->write(current_meas_err,sizeof(real),1);
-           //else
-           resultsfile->printf("%g ",current_meas_err);
-         }
-      }
-      resultsfile->printf("\n");
-      resultsfile->flush();
-    }
+    if(!asynchronous_evaluation)
+      WriteResults(meas, n_meas, n_datas);
 
     print(".");
     err /= (real)(n_train);
@@ -194,7 +272,10 @@ void StochasticGradientPlus::train(DataSet *data, MeasurerList *measurers)
     }
 
   }
+  WaitEvaluation();
   free(shuffle);
+  if(thread_datas)
+    free(thread_datas);
 
   for(int julie = 0; julie < n_datas; julie++)  {
     for(int i = 0; i < n_meas[julie]; i++)
@@ -206,6 +287,295 @@ void StochasticGradientPlus::train(DataSet *data, MeasurerList *measurers)
   delete allocator_;
 }
 
+void StochasticGradientPlus::MeasureDataSets(DataSet **datas, Measurer ***meas, int *n_meas,
+                                             int n_datas, int first_data)
+{
+  for(int julie = first_data; julie < n_datas; julie++)        {
+    DataSet *dataset = datas[julie];
+    if(n_meas[julie] == 0)
+      continue;
+
+    for(int t = 0; t < dataset->n_examples; t++)
+    {
+      dataset->setExample(t);
+      machine->forward(dataset->inputs);
+
+      for(int i = 0; i < n_meas[julie]; i++)
+        meas[julie][i]->measureExample();
+    }
+
+    for(int i = 0; i < n_meas[julie]; i++)
+      meas[julie][i]->measureIteration();
+  }
+}
+
+// Writing all the errors to a results files. Assumes
+// - that each used measurer has a filed called "internal_error"
+// (which is the case for most standard measurers which return
+// a single real as a result
+// - that internal_error is a real
+void StochasticGradientPlus::WriteResults(Measurer ***meas, int *n_meas, int n_datas)
+{
+  if(!resultsfile)
+    return;
+
+  real current_meas_err = 0.;
+  for(int julie = 0; julie < n_datas; julie++)  {
+    for(int i = 0; i < n_meas[julie]; i++) {
+      current_meas_err = meas[julie][i]->current_error;
+      //if (binary_mode)
+      //  resultsfile->write(current_meas_err,sizeof(real),1);
+      //else
+      resultsfile->printf("%g ",current_meas_err);
+    }
+  }
+  resultsfile->printf("\n");
+  resultsfile->flush();
+}
+
+// The runs common to both lists are copied at once.
+void StochasticGradientPlus::CopyParameters(GradientMachine *from, GradientMachine *to)
+{
+  Parameters *a = from->params;
+  Parameters *b = to->params;
+  if(a->n_data != b->n_data)
+    error("StochasticGradientPlus::CopyParameters - the machines have different parameters.");
+  for(int i = 0; i < a->n_data; i++)  {
+    if(a->size[i] != b->size[i])
+      error("StochasticGradientPlus::CopyParameters - the machines have different parameters.");
+  }
+
+  int i = 0;
+  while(i < a->n_data)  {
+    int run_size;
+    int next = NextParameterRun(a, b, i, &run_size);
+    memcpy(b->data[i], a->data[i], sizeof(real)*run_size);
+    i = next;
+  }
+}
+
+static void *EvaluationThread(void *trainer)
+{
+  ((StochasticGradientPlus *)trainer)->RunEvaluation();
+  return NULL;
+}
+
+void StochasticGradientPlus::StartEvaluation(DataSet **datas, Measurer ***meas, int *n_meas, int n_datas)
+{
+  evaluated_datas = datas;
+  evaluated_meas = meas;
+  evaluated_n_meas = n_meas;
+  evaluated_n_datas = n_datas;
+
+  if(pthread_create(&evaluation_thread, NULL, EvaluationThread, this) != 0)   {
+    // Evaluate here rather than not at all.
+    warning("StochasticGradientPlus: could not start the evaluation thread.");
+    RunEvaluation();
+    return;
+  }
+  evaluating = true;
+}
+
+void StochasticGradientPlus::RunEvaluation()
+{
+  ((GradientMachine *)machine)->iterInitialize();
+  criterion->iterInitialize();
+  MeasureDataSets(evaluated_datas, evaluated_meas, evaluated_n_meas, evaluated_n_datas, 0);
+  WriteResults(evaluated_meas, evaluated_n_meas, evaluated_n_datas);
+}
+
+void StochasticGradientPlus::WaitEvaluation()
+{
+  if(!evaluating)
+    return;
+  pthread_join(evaluation_thread, NULL);
+  evaluating = false;
+}
+
+// Runs in the thread of the replica: everything it touches but the shared
+// parameters is its own.
+real StochasticGradientPlus::TrainReplica(StochasticGradientPlus *replica, DataSet *data,
+                                          int *examples, int n_examples, real current_learning_rate)
+{
+  GradientMachine *gm = (GradientMachine *)replica->machine;
+  real err = 0;
+
+  for(int t = 0; t < n_examples; t++)     {
+    if(IsMinibatchStart(t))   {
+      replica->ClearDerivatives(gm);
+      replica->n_accumulated_examples = 0;
+    }
+
+    data->setExample(examples[t]);
+
+    replica->fpropbprop(data);
+    replica->n_accumulated_examples++;
+
+    if(IsMinibatchEnd(t, n_examples))    {
+      replica->PrepareUpdate(replica->n_accumulated_examples);
+      replica->UpdateMachine(gm, current_learning_rate/(real)replica->n_accumulated_examples);
+    }
+
+    err += replica->criterion->outputs->frames[0][0];
+  }
+
+  return err;
+}
+
+real StochasticGradientPlus::TrainSynchronous(DataSet **thread_datas, int *shuffle, int n_train,
+                                              real current_learning_rate)
+{
+  StochasticGradientPlus *first = replicas[0];
+  GradientMachine *first_gm = (GradientMachine *)first->machine;
+  int batch_size = (minibatch_size > 1 ? minibatch_size : 1);
+  real *thread_errs = (real *)Allocator::sysAlloc(n_threads*sizeof(real));
+  real err = 0;
+
+  for(int batch_begin = 0; batch_begin < n_train; batch_begin += batch_size)  {
+    int n_batch = (n_train-batch_begin < batch_size ? n_train-batch_begin : batch_size);
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(n_threads) schedule(static, 1)
+#endif
+    for(int r = 0; r < n_threads; r++)  {
+      int begin = batch_begin + (n_batch*r)/n_threads;
+      int end = batch_begin + (n_batch*(r+1))/n_threads;
+      thread_errs[r] = ComputeReplicaGradient(replicas[r], thread_datas[r], shuffle+begin, end-begin);
+    }
+
+    ReduceReplicaGradients(first->FuseClearWithUpdate());
+    for(int r = 0; r < n_threads; r++)
+      err += thread_errs[r];
+
+    // The other replicas read the weights as they are: the weight decay of
+    // the update is not left pending.
+    first->n_accumulated_examples = n_batch;
+    first->PrepareUpdate(n_batch);
+    first->UpdateMachine(first_gm, current_learning_rate/(real)n_batch);
+    first->FlushWeightDecay();
+  }
+
+  free(thread_errs);
+  return err;
+}
+
+real StochasticGradientPlus::ComputeReplicaGradient(StochasticGradientPlus *replica, DataSet *data,
+                                                    int *examples, int n_examples)
+{
+  real err = 0;
+
+  replica->ClearDerivatives((GradientMachine *)replica->machine);
+  for(int t = 0; t < n_examples; t++)     {
+    data->setExample(examples[t]);
+    replica->fpropbprop(data);
+    err += replica->criterion->outputs->frames[0][0];
+  }
+
+  return err;
+}
+
+// Each chunk of each array is reduced by one thread, along the whole tree, so
+// the threads never write to the same reals.
+void StochasticGradientPlus::ReduceReplicaGradients(bool clear_sources)
+{
+  const int chunk_size = 4096;
+  Parameters *first = ((GradientMachine *)replicas[0]->machine)->der_params;
+  if(!first)
+    return;
+
+  // An array listed twice by the machine is reduced once, with its first
+  // listing.
+  if(n_first_listings < first->n_data)    {
+    first_listings = (bool*)allocator->realloc(first_listings, sizeof(bool)*first->n_data);
+    n_first_listings = first->n_data;
+  }
+  for(int i = 0; i < first->n_data; i++)  {
+    first_listings[i] = true;
+    for(int k = 0; k < i && first_listings[i]; k++)
+      first_listings[i] = (first->data[k] != first->data[i]);
+  }
+
+  for(int i = 0, next; i < first->n_data; i = next)  {
+    if(!first_listings[i])  {
+      next = i+1;
+      continue;
+    }
+    int size;
+    next = NextParameterRun(first, NULL, i, &size, first_listings);
+    int n_chunks = (size + chunk_size - 1) / chunk_size;
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(n_threads) schedule(static)
+#endif
+    for(int c = 0; c < n_chunks; c++)   {
+      int begin = c*chunk_size;
+      int end = (begin + chunk_size < size ? begin + chunk_size : size);
+      for(int stride = 1; stride < n_threads; stride *= 2)  {
+        for(int r = 0; r + stride < n_threads; r += 2*stride)   {
+          real *dst = ((GradientMachine *)replicas[r]->machine)->der_params->data[i];
+          real *src = ((GradientMachine *)replicas[r+stride]->machine)->der_params->data[i];
+          if(clear_sources)   {
+            for(int j = begin; j < end; j++)    {
+              dst[j] += src[j];
+              src[j] = 0;
+            }
+          } else    {
+            for(int j = begin; j < end; j++)
+              dst[j] += src[j];
+          }
+        }
+      }
+    }
+  }
+
+  replicas[0]->SetTouched(first, true);
+  if(clear_sources)   {
+    for(int r = 1; r < n_threads; r++)  {
+      GradientMachine *gm = (GradientMachine *)replicas[r]->machine;
+      replicas[r]->SetTouched(gm->der_params, false);
+      replicas[r]->MarkDerivativesCleared(gm);
+    }
+  }
+}
+
+void StochasticGradientPlus::AddReplica(StochasticGradientPlus *replica, DataSet *replica_data_)
+{
+  replicas = (StochasticGradientPlus**)allocator->realloc(replicas, sizeof(StochasticGradientPlus*)*(n_replicas+1));
+  replica_datas = (DataSet**)allocator->realloc(replica_datas, sizeof(DataSet*)*(n_replicas+1));
+  replicas[n_replicas] = replica;
+  replica_datas[n_replicas] = replica_data_;
+  n_replicas++;
+}
+
+// The replica keeps its own machine and criterion, and trains on its view of
+// the training set.
+DataSet *StochasticGradientPlus::SyncReplica(int r, DataSet *data)
+{
+  return replica_datas[r];
+}
+
+bool StochasticGradientPlus::IsMinibatchStart(int t)
+{
+  return (minibatch_size <= 1) || (t % minibatch_size == 0);
+}
+
+// The last batch of an epoch may be smaller.
+bool StochasticGradientPlus::IsMinibatchEnd(int t, int n_train)
+{
+  return (minibatch_size <= 1) || ((t+1) % minibatch_size == 0) || (t == n_train-1);
+}
+
+// The examples of #data# must be the ones of minibatch_data, and its inputs
+// the same Sequence (e.g. an InputAsTargetDataSet of minibatch_data).
+bool StochasticGradientPlus::GathersMinibatches(DataSet *data)
+{
+  if(!minibatch_data || minibatch_size <= 1 || data->n_examples == 0
+     || data->n_examples != minibatch_data->n_examples)
+    return false;
+  data->setExample(0);
+  return (data->inputs == minibatch_data->inputs);
+}
+
 void StochasticGradientPlus::Shuffle(int n_train, int *shuffle)
 {
   if(do_shuffle)
@@ -241,31 +611,144 @@ void StochasticGradientPlus::fpropbprop(DataSet *data)
   ((GradientMachine *)machine)->backward(data->inputs, criterion->beta);
 }
 
+void StochasticGradientPlus::PrepareUpdate(int n_examples)
+{
+  optimizer->Step();
+}
+
+void StochasticGradientPlus::PrepareOptimizer(GradientMachine *gm)
+{
+  optimizer->AddParameters(gm->params);
+}
+
+// The arrays that follow each other in memory (see ParameterArena) are
+// cleared and updated at once.
 void StochasticGradientPlus::ClearDerivatives(GradientMachine *gm)
 {
+  // Already zero since its last update.
+  for(int k=0; k<n_cleared_machines; k++)    {
+    if(cleared_machines[k] == gm)   {
+      cleared_machines[k] = cleared_machines[--n_cleared_machines];
+      return;
+    }
+  }
+
   Parameters *der_params = gm->der_params;
   if(der_params)    {
-    for(int i=0; i<der_params->n_data; i++)        {
-      memset(der_params->data[i], 0, sizeof(real)*der_params->size[i]);
+    bool *touched = FindTouched(der_params);
+    for(int i=0, next; i<der_params->n_data; i=next)  {
+      if(!touched[i])   {
+        next = i+1;
+        continue;
+      }
+      int run_size;
+      next = NextParameterRun(der_params, NULL, i, &run_size, touched);
+      memset(der_params->data[i], 0, sizeof(real)*run_size);
     }
+    SetTouched(der_params, false);
   }
 }
 
-void StochasticGradientPlus::UpdateMachine(GradientMachine *gm, real current_learning_rate)
+bool *StochasticGradientPlus::FindTouched(Parameters *der_params)
+{
+  if(n_touched_arrays < der_params->n_data)    {
+    touched_arrays = (bool*)allocator->realloc(touched_arrays, sizeof(bool)*der_params->n_data);
+    n_touched_arrays = der_params->n_data;
+  }
+  for(int i=0; i<der_params->n_data; i++)
+    touched_arrays[i] = true;
+  FindTouchedArrays(der_params, touched_arrays);
+  return touched_arrays;
+}
+
+void StochasticGradientPlus::FindTouchedArrays(Parameters *der_params, bool *touched)
+{
+}
+
+void StochasticGradientPlus::SetTouched(Parameters *der_params, bool touched)
+{
+}
+
+bool StochasticGradientPlus::FuseClearWithUpdate()
+{
+  return !keep_derivatives && !measurers_need_derivatives;
+}
+
+void StochasticGradientPlus::MarkDerivativesCleared(GradientMachine *gm)
+{
+  for(int k=0; k<n_cleared_machines; k++)    {
+    if(cleared_machines[k] == gm)
+      return;
+  }
+  cleared_machines = (GradientMachine**)allocator->realloc(cleared_machines, sizeof(GradientMachine*)*(n_cleared_machines+1));
+  cleared_machines[n_cleared_machines++] = gm;
+}
+
+// True if one of the arrays [begin, end) of #der_params# is listed again
+// after them. Such an array is updated once per listing, so it can only be
+// cleared with its last one.
+static bool ListedAgain(Parameters *der_params, int begin, int end)
+{
+  for(int i=begin; i<end; i++)  {
+    for(int k=end; k<der_params->n_data; k++)   {
+      if(der_params->data[k] == der_params->data[i])
+        return true;
+    }
+  }
+  return false;
+}
+
+void StochasticGradientPlus::UpdateParameters(GradientMachine *gm, real current_learning_rate, bool clear)
 {
   Parameters *params = gm->params;
   Parameters *der_params = gm->der_params;
   if(params)        {
-    for(int i=0; i<params->n_data; i++) {
-      real *ptr_params = params->data[i];
-      real *ptr_der_params = der_params->data[i];
-      for(int j=0; j<params->size[i]; j++)      {
-        ptr_params[j] -= current_learning_rate * ptr_der_params[j];
+    // The parameters without gradient keep their value under sgd, and the
+    // state of the other rules stays as it is.
+    bool *touched = FindTouched(der_params);
+    for(int i=0, next; i<params->n_data; i=next)  {
+      if(!touched[i])   {
+        next = i+1;
+        continue;
       }
+      int run_size;
+      next = NextParameterRun(params, der_params, i, &run_size, touched);
+      optimizer->Update(params->data[i], der_params->data[i], run_size, current_learning_rate,
+                        n_accumulated_examples, clear && !ListedAgain(der_params, i, next));
     }
+    if(clear)
+      SetTouched(der_params, false);
   }
 }
 
+void StochasticGradientPlus::UpdateMachine(GradientMachine *gm, real current_learning_rate)
+{
+  bool clear = FuseClearWithUpdate();
+  UpdateParameters(gm, current_learning_rate, clear);
+  if(clear)
+    MarkDerivativesCleared(gm);
+
+  ApplyWeightDecay(gm, current_learning_rate * (real)n_accumulated_examples);
+}
+
+void StochasticGradientPlus::AddDecayedCoder(Coder *coder)
+{
+  decayed_coders = (Coder**)allocator->realloc(decayed_coders, sizeof(Coder*)*(n_decayed_coders+1));
+  decayed_coders[n_decayed_coders++] = coder;
+}
+
+void StochasticGradientPlus::ApplyWeightDecay(GradientMachine *gm, real learning_rate)
+{
+  for(int i=0; i<n_decayed_coders; i++)
+    decayed_coders[i]->ApplyWeightDecay(gm->params, learning_rate);
+}
+
+void StochasticGradientPlus::FlushWeightDecay()
+{
+  for(int i=0; i<n_decayed_coders; i++)
+    decayed_coders[i]->WeightOwner()->FlushWeightDecay();
+}
+
 
 StochasticGradientPlus::~StochasticGradientPlus()
 {
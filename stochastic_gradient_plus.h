@@ -21,12 +21,103 @@
 #include "DataSet.h"
 #include "Criterion.h"
 #include "XFile.h"
+#include "optimizer.h"
+#include <pthread.h>
 
 namespace Torch {
 
+class Coder;
+class MinibatchDataSet;
+
+// A StochasticGradient with hooks for the subclasses and an optional
+// minibatch mode.
+//
+// With a "minibatch size" of B > 1, derivatives are accumulated over B
+// consecutive (shuffled) examples and the machine is updated once per batch
+// with the averaged gradient. The derivatives are cleared once per batch as
+// well.
+//
+// The weight decays of the Coders are applied after each update (see
+// Coder::ApplyWeightDecay). Subclasses that train stacked autoencoders find
+// their coders themselves, other coders are given with AddDecayedCoder.
+//
+// The minibatches can also be run as one example each, through the
+// multi-frame kernels of the machines: give the DataSet the training one reads
+// its inputs from as #minibatch_data# (see MinibatchDataSet). Like with
+// threads, the measurers on the training set are then run once the epoch is
+// trained. This is only for the single-threaded training.
+//
+// With "n threads" N > 1, the epoch is trained Hogwild-style: the shuffled
+// examples are split in N contiguous parts, each trained by a replica of this
+// trainer (see AddReplica) in its own OpenMP thread. The replicas' machines
+// share the parameters of this machine but have their own buffers and
+// der_params, and update the shared parameters without any lock. This
+// trainer's own machine is only used to measure, between the epochs: the
+// measurers on the training set are run over it once the epoch is trained,
+// instead of on the fly. Without OpenMP, the parts are trained one after the
+// other.
+//
+// With "synchronous threads" as well, training is data-parallel and
+// reproducible instead: each minibatch is split across the replicas, their
+// der_params are summed into the first replica's in a fixed order (see
+// ReduceReplicaGradients), and the first replica alone updates the shared
+// parameters. The results only depend on the number of threads.
+//
+// The updates follow the rule of #optimizer# (see Optimizer), plain SGD by
+// default. Its state is reset at the start of each training, and the
+// replicas use this trainer's.
+//
+// With "asynchronous evaluation" (threaded only), the measurers of an epoch
+// run in their own thread while the next epoch trains. The replicas must then
+// be execution contexts of a copy of the machine, which gets the parameters
+// of this machine when the training starts. At the end of each epoch, the
+// parameters of the copy are copied into this machine, which is measured on
+// all the DataSets, the training one included, as a snapshot. The results
+// are written in epoch order: an evaluation waits for the previous one.
+//
+// Unless a measurer reads der_params (see DerivativesReader) or "keep
+// derivatives" is set, UpdateMachine zeroes der_params in the same sweep as
+// the update, and the ClearDerivatives of the next minibatch is skipped (see
+// MarkDerivativesCleared). der_params then reads zero after an update.
 class StochasticGradientPlus : public StochasticGradient
 {
   public:
+    int minibatch_size;
+    int n_accumulated_examples;   // number of examples whose gradient is in
+                                  // der_params at update time.
+    // The view of the training set that gathers the minibatches, if any.
+    MinibatchDataSet *minibatch_data;
+    Coder **decayed_coders;
+    int n_decayed_coders;
+
+    int n_threads;
+    bool synchronous_threads;
+    StochasticGradientPlus **replicas;
+    DataSet **replica_datas;        // their own view of the training set
+    int n_replicas;
+
+    Optimizer *optimizer;
+    bool keep_derivatives;
+    // Set by train from its measurers (see NeedsDerivatives).
+    bool measurers_need_derivatives;
+    // The machines whose der_params were zeroed by their last update, and
+    // which were not cleared since.
+    GradientMachine **cleared_machines;
+    int n_cleared_machines;
+    bool *touched_arrays;         // buffer of FindTouched
+    int n_touched_arrays;
+    bool *first_listings;         // buffer of ReduceReplicaGradients
+    int n_first_listings;
+
+    bool asynchronous_evaluation;
+    // The evaluation running in its thread, see StartEvaluation.
+    bool evaluating;
+    pthread_t evaluation_thread;
+    DataSet **evaluated_datas;
+    Measurer ***evaluated_meas;
+    int *evaluated_n_meas;
+    int evaluated_n_datas;
+
     StochasticGradientPlus(GradientMachine *machine_, Criterion *criterion_, XFile* resultsfile_);
 
     virtual void train(DataSet *data, MeasurerList *measurers);
@@ -41,8 +132,98 @@ class StochasticGradientPlus : public StochasticGradient
 
     virtual void fpropbprop(DataSet *data);
 
+    // True if example #t# (in shuffled order) starts/ends a minibatch.
+    virtual bool IsMinibatchStart(int t);
+    virtual bool IsMinibatchEnd(int t, int n_train);
+    // True if #data# reads its inputs from minibatch_data, which can then
+    // gather its minibatches. Sets an example of #data#.
+    virtual bool GathersMinibatches(DataSet *data);
+
+    // Called before each update, with the number of examples whose gradient
+    // is in der_params. Subclasses add there the gradients that only depend
+    // on the parameters (see SmoothedLinear), and call this one, which
+    // counts the step of the optimizer.
+    virtual void PrepareUpdate(int n_examples);
+    // Gives the optimizer a state for the parameters of #gm#, before it is
+    // trained.
+    virtual void PrepareOptimizer(GradientMachine *gm);
+
+    // Does nothing if the der_params of #gm# are still zero from its last
+    // update.
     virtual void ClearDerivatives(GradientMachine *gm);
     virtual void UpdateMachine(GradientMachine *gm, real current_learning_rate);
+    // The step of the optimizer for #current_learning_rate#, without the
+    // weight decay. With #clear#, der_params are zeroed in the same sweep.
+    virtual void UpdateParameters(GradientMachine *gm, real current_learning_rate, bool clear);
+    // True if the updates may clear the derivatives they read.
+    virtual bool FuseClearWithUpdate();
+    // Records that the der_params of #gm# are all zero, so that its next
+    // ClearDerivatives can be skipped.
+    virtual void MarkDerivativesCleared(GradientMachine *gm);
+
+    // Which arrays of #der_params# may have received a gradient since they
+    // were last cleared. The clears and updates skip the others. The
+    // returned buffer is overwritten by the next call.
+    bool *FindTouched(Parameters *der_params);
+    // Clears the entries of #touched# (all true on entry) for the arrays known
+    // to be zero. The subclasses know the groups of their machines (see
+    // Coder::derivatives_touched), the default keeps them all.
+    virtual void FindTouchedArrays(Parameters *der_params, bool *touched);
+    // Records that the arrays of #der_params# were cleared, or may have
+    // received a gradient.
+    virtual void SetTouched(Parameters *der_params, bool touched);
+
+    // Adds a trainer for one of the threads. Its machine must share the
+    // parameters of this one, and #replica_data_# be a view of the training
+    // DataSet that is safe to use from a thread (see SharedDataSet).
+    virtual void AddReplica(StochasticGradientPlus *replica, DataSet *replica_data_);
+    // Sets up replica #r# to train like this trainer does on #data#, and
+    // returns the DataSet it should train on.
+    virtual DataSet *SyncReplica(int r, DataSet *data);
+    // Trains #replica# on its part of the epoch, and returns the sum of its
+    // criterion's outputs.
+    virtual real TrainReplica(StochasticGradientPlus *replica, DataSet *data,
+                              int *examples, int n_examples, real current_learning_rate);
+    // Trains one epoch with the minibatches split across the replicas, and
+    // returns the sum of the criterions' outputs.
+    virtual real TrainSynchronous(DataSet **thread_datas, int *shuffle, int n_train,
+                                  real current_learning_rate);
+    // Computes the gradient of #replica# on #examples# in its der_params, and
+    // returns the sum of its criterion's outputs.
+    virtual real ComputeReplicaGradient(StochasticGradientPlus *replica, DataSet *data,
+                                        int *examples, int n_examples);
+    // Sums the der_params of the replicas into the first one's, along a binary
+    // tree whose shape only depends on the number of threads. The tied
+    // weights have their gradient in the der_params of the coder owning them,
+    // so each array is reduced once. With #clear_sources#, the der_params of
+    // the other replicas are zeroed as they are read.
+    virtual void ReduceReplicaGradients(bool clear_sources=false);
+
+    // Forwards the examples of the DataSets from #first_data# on for their
+    // measurers, and ends the iteration of the measurers.
+    virtual void MeasureDataSets(DataSet **datas, Measurer ***meas, int *n_meas,
+                                 int n_datas, int first_data);
+    // Writes the errors of the measurers as a line of resultsfile.
+    virtual void WriteResults(Measurer ***meas, int *n_meas, int n_datas);
+    // Copies the parameters of #from# into the ones of #to#, which must have
+    // the same arrays.
+    virtual void CopyParameters(GradientMachine *from, GradientMachine *to);
+    // Measures all the DataSets with this machine and writes the results, in
+    // a thread. The machine and the criterion are the thread's until
+    // WaitEvaluation.
+    virtual void StartEvaluation(DataSet **datas, Measurer ***meas, int *n_meas, int n_datas);
+    // The body of the evaluation thread.
+    virtual void RunEvaluation();
+    // Returns once the evaluation, if any, is over.
+    virtual void WaitEvaluation();
+
+    virtual void AddDecayedCoder(Coder *coder);
+    // Called after #gm# was updated with the gradient averaged over the
+    // minibatch and learning_rate for one example.
+    virtual void ApplyWeightDecay(GradientMachine *gm, real learning_rate);
+    // Brings the lazy weight decay into the weights, so that they can be read
+    // directly.
+    virtual void FlushWeightDecay();
 
     virtual ~StochasticGradientPlus();
 
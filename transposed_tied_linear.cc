@@ -15,6 +15,7 @@
 
 #include "transposed_tied_linear.h"
 #include "Random.h"
+#include "linear_kernels.h"
 
 namespace Torch {
 
@@ -44,75 +45,23 @@ TransposedTiedLinear::TransposedTiedLinear(int n_inputs_, int n_outputs_, Linear
   reset_();
 }
 
+// Both directions go through the tiled kernels of linear_kernels.h, with the
+// reparametrization multiplier folded in.
 void TransposedTiedLinear::frameForward(int t, real *f_inputs, real *f_outputs)
 {
-  for(int i=0; i<n_outputs; i++)    {
-    //f_outputs[i] = bias[i]; // reparametrization does not apply to bias!
-    f_outputs[i] = 0.0;
-  }
-
-  real *weights_ = weights;
-  real input_i_;
-  for(int i=0; i<n_inputs; i++)    {
-    input_i_ = f_inputs[i];
-    for(int j=0; j< n_outputs; j++) {
-      f_outputs[j] += weights_[j] * input_i_;
-    }
-    weights_ += n_outputs;
-  }
-
-  if (reparametrize)  {
-    for(int i=0; i<n_outputs; i++)  {
-      f_outputs[i] *= reparametrization_multiplier;
-      f_outputs[i] += bias[i];
-    }
-  }
+  // The reparametrization does not apply to the bias, which is only used when
+  // reparametrizing.
+  TransposedLinearForwardFrames(weights, (reparametrize ? bias : NULL),
+                                (reparametrize ? reparametrization_multiplier : 1.),
+                                n_inputs, n_outputs, &f_inputs, &f_outputs, 1);
 }
 
 void TransposedTiedLinear::frameBackward(int t, real *f_inputs, real *beta_, real *f_outputs, real *alpha_)
 {
-  if(!partial_backprop) {
-    for(int i=0; i<n_inputs; i++)   {
-      beta_[i]=0.;
-    }
-
-    real *weights_ = weights;
-    for(int i=0; i<n_inputs; i++)      {
-      for(int j=0; j<n_outputs; j++)
-        beta_[i] += alpha_[j] * weights_[j];
-      weights_ += n_outputs;
-    }
-
-    if (reparametrize)  {
-      for(int i=0; i<n_inputs; i++)
-        beta_[i] *= reparametrization_multiplier;
-    }
-  }
-
-  //  --------------------
-  for(int i=0; i<n_outputs; i++)        {
-    der_bias[i] += alpha_[i];
-  }
-
-  // derive wrt weights
-  if (!reparametrize) {
-    real *der_weights_ = der_weights;
-    for(int i=0; i<n_inputs; i++)        {
-      for(int j=0; j<n_outputs; j++)      {
-        der_weights_[j] += alpha_[j] * f_inputs[i];
-      }
-      der_weights_ += n_outputs;
-    }
-  } else  {
-    real *der_weights_ = der_weights;
-    for(int i=0; i<n_inputs; i++)        {
-      for(int j=0; j<n_outputs; j++)      {
-        der_weights_[j] += reparametrization_multiplier * alpha_[j] * f_inputs[i];
-      }
-      der_weights_ += n_outputs;
-    }
-  }
-
+  TransposedLinearBackwardFrames(weights, der_weights, der_bias,
+                                 (reparametrize ? reparametrization_multiplier : 1.),
+                                 n_inputs, n_outputs, &f_inputs, &alpha_,
+                                 (partial_backprop ? NULL : &beta_), 1);
 }
 
 void TransposedTiedLinear::reset_()